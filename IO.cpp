@@ -65,4 +65,181 @@ double ReadParameterDefaultValue(char* filename, std::string name, double def) {
     //Reached end-of-file. Could not find named parameter. Return default value
     in.close();
     return def;
-}
\ No newline at end of file
+}
+namespace
+{
+    // Convert the whole of str to a double, returning false if any of it isn't part of the number.
+    bool toDouble(const std::string& str, double& value)
+    {
+        if (str.empty()) return false;
+        char* end;
+        value = strtod(str.c_str(), &end);
+        return *end == '\0';
+    }
+}
+
+std::vector<double> ReadParameterList(char* filename, std::string name) {
+    std::ifstream in;
+    open(filename, in);
+
+    std::string word;
+    while (in) {
+        in >> word;
+        if (word == name)
+        {
+            std::string list;
+            in >> list;
+            in.close();
+
+            std::vector<double> values;
+            std::stringstream liststream(list);
+            std::string item;
+            while (std::getline(liststream, item, ','))
+            {
+                double value;
+                if (item.find(':') == std::string::npos)
+                {
+                    if (!toDouble(item, value))
+                    {
+                        std::cout << "***ERROR***: Could not convert value " << item << " of parameter " << name << " to double.\n";
+                        exit(-1);
+                    }
+                    values.push_back(value);
+                    continue;
+                }
+
+                // Range start:stop:count
+                std::stringstream itemstream(item);
+                std::string start, stop, count;
+                std::getline(itemstream, start, ':');
+                std::getline(itemstream, stop, ':');
+                std::getline(itemstream, count, ':');
+                double a, b, n;
+                if (!toDouble(start, a) || !toDouble(stop, b) || !toDouble(count, n) || n < 1 || n != floor(n) || !itemstream.eof())
+                {
+                    std::cout << "***ERROR***: Could not interpret range " << item << " of parameter " << name << ". Expected start:stop:count.\n";
+                    exit(-1);
+                }
+                for (int k = 0; k < (int)n; k++)
+                    values.push_back((n == 1) ? a : a + (b - a) * k / (n - 1));
+            }
+
+            if (values.empty())
+            {
+                std::cout << "***ERROR***: Could not convert parameter value to double.\n";
+                exit(-1);
+            }
+            return values;
+        }
+    }
+    std::cout << "***ERROR***: Reached end-of-file. Could not find " << name << " in " << filename << "\n";
+    in.close();
+    exit(-1);
+}
+
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+mappedFile::mappedFile(const char* filename)
+{
+    _file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (_file == INVALID_HANDLE_VALUE) {
+        std::cout << "***ERROR***: Unable to open " << filename << std::endl;
+        exit(-1);
+    }
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(_file, &size);
+    _size = (size_t)size.QuadPart;
+    if (_size == 0) return; // Can't map an empty file.
+
+    _mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (_mapping) _data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!_data) {
+        std::cout << "***ERROR***: Unable to map " << filename << " into memory" << std::endl;
+        exit(-1);
+    }
+}
+
+mappedFile::~mappedFile()
+{
+    if (_data) UnmapViewOfFile(_data);
+    if (_mapping) CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+}
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mappedFile::mappedFile(const char* filename)
+{
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        std::cout << "***ERROR***: Unable to open " << filename << std::endl;
+        exit(-1);
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    _size = (size_t)st.st_size;
+    if (_size > 0) // Can't map an empty file.
+    {
+        void* p = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            std::cout << "***ERROR***: Unable to map " << filename << " into memory" << std::endl;
+            exit(-1);
+        }
+        _data = (const char*)p;
+        madvise(p, _size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+}
+
+mappedFile::~mappedFile()
+{
+    if (_data) munmap((void*)_data, _size);
+}
+#endif
+
+namespace
+{
+    // Move p past spaces, tabs and carriage returns.
+    void skipSpace(const char*& p, const char* end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    }
+}
+
+bool ParseValue(const char*& p, const char* end, double& value)
+{
+    skipSpace(p, end);
+    if (p < end && *p == '+') p++; // from_chars doesn't accept a leading '+', but streams do.
+    std::from_chars_result res = std::from_chars(p, end, value);
+    if (res.ec != std::errc()) return false;
+    p = res.ptr;
+    return true;
+}
+
+bool ParseValue(const char*& p, const char* end, long long& value)
+{
+    skipSpace(p, end);
+    if (p < end && *p == '+') p++;
+    std::from_chars_result res = std::from_chars(p, end, value);
+    if (res.ec != std::errc()) return false;
+    p = res.ptr;
+    return true;
+}
+
+bool ParseValue(const char*& p, const char* end, char& value)
+{
+    skipSpace(p, end);
+    if (p >= end) return false;
+    value = *p++;
+    return true;
+}
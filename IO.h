@@ -1,6 +1,123 @@
 #pragma once
 #include "pch.h"
+#include "parallel.h"
 
 double ReadParameter(char* filename, std::string name);
 double ReadParameterDefaultValue(char* filename, std::string name, double def);
-void open(char* filename, std::ifstream& filestream);
\ No newline at end of file
+void open(char* filename, std::ifstream& filestream);
+
+// Read a parameter which may take several values, for parameter sweeps.
+// The value is a comma separated list (without spaces), where each item is either a single value
+// or a range start:stop:count of count evenly spaced values from start to stop inclusive.
+// e.g. "fieldZ 0.001,0.002,0.005" or "temp 200:300:11"
+std::vector<double> ReadParameterList(char* filename, std::string name);
+
+// A read-only memory mapping of a whole file.
+// The contents can be read directly from memory without copying them through a stream.
+class mappedFile
+{
+private:
+
+	const char* _data = NULL;
+	size_t _size = 0;
+
+#ifdef _WIN32
+	void* _file = NULL;
+	void* _mapping = NULL;
+#endif
+
+public:
+
+	// Map the named file. Exits with an error message if the file cannot be opened.
+	mappedFile(const char* filename);
+
+	// Unmap the file.
+	~mappedFile();
+
+	// The mapping is owned by this object, so it can't be copied.
+	mappedFile(const mappedFile&) = delete;
+	mappedFile& operator=(const mappedFile&) = delete;
+
+	const char* data() const { return _data; }
+	size_t size() const { return _size; }
+};
+
+// Parse the next whitespace separated value on a line, advancing p past it.
+// Return false if there is no value, or it can't be converted to the requested type.
+bool ParseValue(const char*& p, const char* end, double& value);
+bool ParseValue(const char*& p, const char* end, long long& value);
+bool ParseValue(const char*& p, const char* end, char& value);
+
+// Parse every line of a file in parallel.
+// The file is split into chunks on line boundaries which are handed out to NumThreads() threads.
+// parseLine(begin, end, value) is called for each line, returning false if the line is badly formatted.
+// The parsed values are returned in file order. If any line fails to parse, badLine is set to the
+// (1-based) number of the first bad line, otherwise it is set to 0.
+template<typename T, typename F>
+std::vector<T> ParseLines(const mappedFile& file, const F& parseLine, size_t& badLine)
+{
+	const char* begin = file.data();
+	const char* end = begin + file.size();
+
+	// Split into several chunks per thread so that uneven lines are balanced, ending each chunk after a newline.
+	size_t numChunks = std::max<size_t>(1, std::min<size_t>(4 * NumThreads(), file.size() / 65536));
+	std::vector<const char*> chunkStart(numChunks + 1, end);
+	chunkStart[0] = begin;
+	for (size_t c = 1; c < numChunks; c++)
+	{
+		const char* p = std::max(chunkStart[c - 1], begin + c * (file.size() / numChunks));
+		while (p < end && p != begin && *(p - 1) != '\n') p++;
+		chunkStart[c] = p;
+	}
+
+	// Parse each chunk, counting its lines and noting the first one which fails.
+	std::vector<std::vector<T>> values(numChunks);
+	std::vector<size_t> lines(numChunks, 0);
+	std::vector<size_t> firstBad(numChunks, 0);
+	ParallelFor(numChunks, [&](size_t c)
+	{
+		const char* p = chunkStart[c];
+		const char* chunkEnd = chunkStart[c + 1];
+		while (p < chunkEnd)
+		{
+			const char* lineEnd = (const char*)memchr(p, '\n', chunkEnd - p);
+			if (!lineEnd) lineEnd = chunkEnd;
+			lines[c]++;
+
+			T value;
+			if (parseLine(p, lineEnd, value))
+				values[c].push_back(value);
+			else
+			{
+				firstBad[c] = lines[c];
+				return;
+			}
+			p = lineEnd + 1;
+		}
+	});
+
+	// Join the chunks, converting line numbers within a chunk to line numbers within the file.
+	badLine = 0;
+	size_t total = 0;
+	size_t lineOffset = 0;
+	for (size_t c = 0; c < numChunks; c++)
+	{
+		if (firstBad[c])
+		{
+			badLine = lineOffset + firstBad[c];
+			return std::vector<T>();
+		}
+		total += values[c].size();
+		lineOffset += lines[c];
+	}
+
+	std::vector<T> result;
+	result.reserve(total);
+	for (size_t c = 0; c < numChunks; c++)
+	{
+		result.insert(result.end(), values[c].begin(), values[c].end());
+		std::vector<T>().swap(values[c]);
+	}
+
+	return result;
+}
@@ -6,38 +6,371 @@
 #include "utility.h"
 #include "IO.h"
 #include "site.h"
+#include "graph.h"
 #include "transporter.h"
+#include "solver.h"
+#include "parallel.h"
+#include "sweep.h"
+#include "marcus.h"
+#include "propagate.h"
+#include "transient.h"
+#include "spectrum.h"
+#include "ordering.h"
+#include "balance.h"
+#include "profile.h"
+#include "output.h"
+#include <array>
 
 
 // Simulation parameter labels
+const char* label_F_x = "fieldX"; // Electric field strength in X direction.
+const char* label_F_y = "fieldY"; // Electric field strength in Y direction.
 const char* label_F_z = "fieldZ"; // Electric field strength in Z direction.
 const char* label_T = "temp"; // Temperature
 const char* label_reorg = "reorg"; // Reorganisation energy
-const char* label_periodic = "periodicZ"; // Information for periodic boundary conditions 
+const char* label_periodicX = "periodicX"; // Information for periodic boundary conditions, the period along each axis
+const char* label_periodicY = "periodicY";
+const char* label_periodic = "periodicZ";
 
 // Options
 bool verbose = false;
-bool periodic = false;
+periodicBox box;
+bool mobilityTensor = false;
 bool rescale = false;
+bool logDomain = false;
+int refine = 0;
+bool denseAssembly = false;
 double tolerance = 0.0;
 double transE = 0.0;
 std::vector<double> propagate;
 transporter::PrecondForm form = transporter::PrecondForm::off;
+SolverForm solver = SolverForm::svd;
+double solverTol = 1e-10;
+int maxIter = 10000;
+transientSettings transient;
+double initialField = 0.0;
+eigenSettings eigen;
+bool splitComponents = true;
+BalanceForm balanceForm = BalanceForm::off;
+KrylovPrecond krylovPrecond = KrylovPrecond::jacobi;
+SiteOrder siteOrder = SiteOrder::file;
+std::string profile;
+OutputMode output = OutputMode::full;
+OccFormat occFormat = OccFormat::text;
+bool keepOccupations = false;
+std::string fluxPrefix;
+
+// Occupation probabilities, and current in z carried out of each site, of every solution found, for the occupation file.
+std::vector<std::vector<double>> occSolutions;
+std::vector<std::vector<double>> occCurrents;
+
+// Internal index of each site, in the order of the input files. Empty if the sites haven't been reordered.
+std::vector<size_t> siteIndex;
+
+// Print a vector of per-site values in the order of the input files.
+void printSiteVector(gsl_vector* v)
+{
+    if (siteIndex.empty())
+    {
+        printVector(v);
+        return;
+    }
+
+    gsl_vector* inFile = gsl_vector_alloc(v->size);
+    for (size_t j = 0; j < v->size; j++)
+        gsl_vector_set(inFile, j, gsl_vector_get(v, siteIndex[j]));
+    printVector(inFile);
+    gsl_vector_free(inFile);
+}
+
+// Print the position and occupation probability of each site, in the order of the input files.
+void printSiteOccupations(std::vector<site>& sites)
+{
+    if (siteIndex.empty())
+    {
+        printOccProbs(sites, 6);
+        return;
+    }
+
+    std::vector<site> inFile(sites.size());
+    for (size_t j = 0; j < sites.size(); j++)
+        inFile[j] = sites[siteIndex[j]];
+    printOccProbs(inFile, 6);
+}
+
+// Set the occupation probabilities of the sites to P, print them under heading (in full output mode only, and not at all
+// if heading is NULL), and keep them for the occupation file.
+void reportOccupations(transporter& transport, std::vector<site>& sites, const std::vector<double>& P, const char* heading)
+{
+    for (size_t j = 0; j < sites.size(); j++)
+        sites[j].occProb = P[j];
+    if (output == OutputMode::full && heading)
+    {
+        std::cout << heading;
+        printSiteOccupations(sites);
+    }
+    if (keepOccupations)
+    {
+        occSolutions.push_back(P);
+        occCurrents.push_back(transport.SiteVelocityZ(P));
+    }
+}
+
+// Find the net flow along every edge and through every site for the occupation probabilities P, summarise it,
+// and write it to the flux map files. Solutions after the first get their number appended to the file names.
+void writeFluxMap(transporter& transport, const std::vector<site>& sites, const siteGraph& graph, const std::vector<double>& P, int solution)
+{
+    if (fluxPrefix.empty()) return;
+    profileStage stage("flux");
+    fluxMap flux = transport.FluxMap(P);
+    double v[3] = { 0.0, 0.0, 0.0 }, divergence = 0.0;
+    for (size_t j = 0; j < sites.size(); j++)
+    {
+        v[0] += flux.siteX[j];
+        v[1] += flux.siteY[j];
+        v[2] += flux.siteZ[j];
+        divergence = std::max(divergence, std::abs(flux.divergence[j]));
+    }
+    std::string prefix = (solution > 1) ? fluxPrefix + "_" + std::to_string(solution) : fluxPrefix;
+    WriteFluxMap(prefix, sites, graph, siteIndex, flux);
+    stage.Set("edges", graph.numEdges());
+    std::cout << "\nFlux map written to " << prefix << ".sites and " << prefix << ".edges\n"
+        << "velocity (x, y, z) (Ang/s) = (" << v[0] << ", " << v[1] << ", " << v[2] << ")\n"
+        << "max |divergence| (1/s) = " << divergence << "\n";
+}
+
+// Write the solutions kept by reportOccupations to the occupation file, if one was given.
+void writeOccupations(const char* filename, const std::vector<site>& sites)
+{
+    if (!keepOccupations) return;
+    profileStage stage("output");
+    WriteOccupations(filename, occFormat, sites, siteIndex, occSolutions, occCurrents);
+    stage.Set("solutions", occSolutions.size());
+    std::cout << "\nWrote " << occSolutions.size() << " solution(s) to " << filename << "\n";
+}
+
+// Propagate densities Q in time using the sparse rate matrix (Can be useful to check if the solution is steady state).
+void propagateDensities(const sparseMatrix& cleanA, const std::vector<double>& Q)
+{
+    const size_t M = Q.size();
+    std::cout << "\nTime propagation\n";
+    std::vector<std::vector<double>> Qt;
+    profileStage stage("propagation");
+    propagateInfo info = Propagate(cleanA, Q, propagate, Qt, solverTol);
+    stage.Set("steps", info.steps);
+    stage.Set("rejected", info.rejected);
+    stage.End();
+    std::cout << "Krylov steps = " << info.steps << " (" << info.rejected << " rejected), estimated error = " << info.error << "\n";
+    if (info.dense)
+        std::cout << "***WARNING***: Krylov step limit reached, later times found by dense matrix exponentials.\n";
+    else if (info.stepLimit)
+        std::cout << "***WARNING***: Krylov step limit reached, later times are omitted.\n";
+    else if (!info.converged)
+        std::cout << "***WARNING***: Time propagation could not reach the requested tolerance, later times are omitted.\n";
+
+    gsl_vector* v = gsl_vector_alloc(M);
+    for (size_t i = 0; i < propagate.size(); i++)
+    {
+        if (Qt[i].empty()) continue;
+
+        double change = 0.0;
+        for (size_t j = 0; j < M; j++)
+        {
+            gsl_vector_set(v, j, Qt[i][j]);
+            change = std::max(change, std::abs(Qt[i][j] - Q[j]));
+        }
+        std::cout << "\nP( " << propagate[i] << "s ) = \n";
+        if (output == OutputMode::full)
+            printSiteVector(v);
+        std::cout << "max |P(t) - P(0)| = " << change << "\n";
+    }
+    gsl_vector_free(v);
+}
+
+// Reverse the preconditioning of a solution P of the preconditioned rate matrix, and renormalise so values add to 1.
+void reversePreconditioning(transporter& transport, std::vector<double>& P)
+{
+    transport.RemovePreconditioning(P, form);
+}
+
+// The null vector of A: the right singular vector with the smallest singular value, found by dense SVD.
+std::vector<double> denseNullVector(const sparseMatrix& A, double& sval)
+{
+    const size_t n = A.size;
+    gsl_matrix* U = A.toDense();
+    gsl_matrix* V = gsl_matrix_alloc(n, n);
+    gsl_vector* S = gsl_vector_alloc(n);
+    gsl_vector* work = gsl_vector_alloc(n);
+    gsl_linalg_SV_decomp(U, V, S, work);
+
+    // Singular values are in decreasing order
+    sval = gsl_vector_get(S, n - 1);
+    std::vector<double> P(n);
+    for (size_t j = 0; j < n; j++)
+        P[j] = gsl_matrix_get(V, j, n - 1);
+
+    gsl_matrix_free(U);
+    gsl_matrix_free(V);
+    gsl_vector_free(S);
+    gsl_vector_free(work);
+    return P;
+}
+
+// Find the steady state of each connected component of the system separately, in parallel, and combine them.
+// No charge moves between components, so each keeps the share of the occupation probability it starts with;
+// this takes the charge to be initially spread evenly over the sites, i.e. each share is the component's fraction of the sites.
+std::vector<double> solveComponents(const std::vector<site>& sites, const siteGraph& graph, const std::vector<size_t>& component, size_t numComponents,
+    double kBT, double F_x, double F_y, double F_z, double reorg)
+{
+    std::vector<subsystem> parts = SplitComponents(sites, graph, component, numComponents);
+    std::vector<double> P(sites.size());
+    std::vector<solveInfo> info(numComponents);
+    std::vector<double> v_z(numComponents, 0.0);
+
+    ParallelFor(numComponents, [&](size_t c)
+    {
+        const subsystem& part = parts[c];
+        std::vector<double> Pc(1, 1.0);
+        info[c].converged = true;
+        if (part.sites.size() > 1)
+        {
+            transporter tc(part.sites, part.graph, kBT, F_x, F_y, F_z, reorg, transE, logDomain);
+            sparseMatrix A = tc.CreateSparseRateMatrix(form, false, false);
+            if (solver == SolverForm::svd)
+                Pc = denseNullVector(A, info[c].residual);
+            else
+                info[c] = SteadyState(A, Pc, solver, solverTol, maxIter, krylovPrecond, refine);
+
+            // Reverse preconditioning and normalise so values add to 1 (which also fixes the sign of a singular vector)
+            tc.RemovePreconditioning(Pc, form);
+            NormaliseSteadyState(Pc);
+
+            v_z[c] = tc.velocity_z(Pc);
+        }
+
+        double share = (double)part.sites.size() / sites.size();
+        for (size_t j = 0; j < Pc.size(); j++)
+            P[part.index[j]] = share * Pc[j];
+    });
+
+    // SVD isn't iterative, so has no iterations column.
+    const bool iterative = solver != SolverForm::svd;
+    std::cout << "\n" << std::setw(12) << std::left << "Component" << std::setw(10) << "Sites";
+    if (iterative) std::cout << std::setw(12) << "Iterations";
+    std::cout << std::setw(16) << (iterative ? "Residual" : "Singular value") << "velocity_z (Ang/s)\n";
+    bool converged = true;
+    for (size_t c = 0; c < numComponents; c++)
+    {
+        std::cout << std::setw(12) << std::left << c << std::setw(10) << parts[c].sites.size();
+        if (iterative) std::cout << std::setw(12) << info[c].iterations;
+        std::cout << std::setw(16) << info[c].residual << v_z[c] << "\n";
+        converged = converged && info[c].converged;
+    }
+    if (!converged)
+        std::cout << "***WARNING***: Solver did not converge to the requested tolerance for every component.\n";
+
+    return P;
+}
+
+// Name of a steady state solver, for messages.
+const char* solverName(SolverForm form)
+{
+    switch (form)
+    {
+        case SolverForm::svd: return "SVD";
+        case SolverForm::bicgstab: return "BiCGSTAB";
+        case SolverForm::gmres: return "GMRES";
+        case SolverForm::arnoldi: return "shift-invert Arnoldi";
+        case SolverForm::direct: return "sparse LU";
+    }
+    return "";
+}
+
+// Print the velocity and, if a field is applied, the mobility along it, v . F / |F|^2.
+// The x and y components are only printed along a periodic axis or one with a field, as otherwise no charge can flow along them.
+void printVelocity(const std::array<double, 3>& v, double F_x, double F_y, double F_z)
+{
+    std::cout << "\n";
+    if (F_x != 0.0 || box.X > 0.0) std::cout << "velocity_x (Ang/s) = " << v[0] << " \n";
+    if (F_y != 0.0 || box.Y > 0.0) std::cout << "velocity_y (Ang/s) = " << v[1] << " \n";
+    std::cout << "velocity_z (Ang/s) = " << v[2] << " \n";
+    const double F2 = F_x * F_x + F_y * F_y + F_z * F_z;
+    if (F2 != 0.0)
+    {
+        double mob = (v[0] * F_x + v[1] * F_y + v[2] * F_z) / F2;
+        std::cout << "mobility (Ang^2 / V*s)= " << mob << "\n";
+        std::cout << "mobility (cm^2 / V*s)= " << mob * 1e-16 << "\n";
+    }
+}
+
+// Velocity of the occupation probabilities P, or of those of the sites if P is empty, as a profiled stage.
+std::array<double, 3> velocity(transporter& transport, const std::vector<double>& P = {})
+{
+    profileStage stage("velocity");
+    std::array<double, 3> v;
+    if (P.empty())
+        transport.Velocity(v[0], v[1], v[2]);
+    else
+        transport.Velocity(P, v[0], v[1], v[2]);
+    return v;
+}
+
+// Record the outcome of a steady state solve in its stage.
+void setSolveMetrics(profileStage& stage, const solveInfo& info)
+{
+    stage.Set("iterations", info.iterations);
+    stage.Set("residual", info.residual);
+    stage.Set("refinements", info.refinements);
+    stage.Set("backwardError", info.backwardError);
+    stage.Set("converged", info.converged);
+}
+
+// A stage of a sweep, recorded by the profiler.
+class sweepProfileStage : public sweepStage
+{
+private:
+    profileStage _stage;
+
+public:
+    sweepProfileStage(const char* name) : _stage(name) {}
+    void Set(const std::string& key, double value) override { _stage.Set(key, value); }
+};
+
+std::unique_ptr<sweepStage> startSweepStage(const char* name)
+{
+    return std::unique_ptr<sweepStage>(new sweepProfileStage(name));
+}
 
 int main(int argc, char* argv[])
 {
+    // Convert mode: write the sites and interactions in a pair of text files to a binary graph file,
+    // which can then be passed in place of the .xyz and .edge files to skip parsing.
+    if (argc >= 2 && strcmp(argv[1], "convert") == 0)
+    {
+        if (argc != 5) {
+            std::cout << "*** ERROR ***: Usage: convert <.xyz> <.edge> <binary graph file>\n";
+            exit(-1);
+        }
+        siteGraph graph;
+        std::vector<site> sites = CreateSites(argv[2], argv[3], graph);
+        WriteGraph(argv[4], sites, graph);
+        std::cout << "Wrote " << sites.size() << " sites and " << graph.numEdges() << " edges to " << argv[4] << "\n";
+        return 0;
+    }
+
     //Parse command line parameters.
-    if (argc < 4) {
-        std::cout << "*** ERROR ***: Expect at least three input files: .sim, .xyz, .edge\n";
+    if (argc < 3) {
+        std::cout << "*** ERROR ***: Expect at least three input files: .sim, .xyz, .edge (or two: .sim, .meg)\n";
         exit(-1);
     }
-    char sim[128], xyz[128], edge[128], occ[128];
+    char sim[128] = "", xyz[128] = "", edge[128] = "", occ[128] = "";
     for (int i = 1; i < argc; i++) {
 
         // Input files
         if (strstr(argv[i], ".sim"))  strcpy_s(sim, argv[i]);
         if (strstr(argv[i], ".xyz"))  strcpy_s(xyz, argv[i]);
         if (strstr(argv[i], ".edge")) strcpy_s(edge, argv[i]);
+        if (strstr(argv[i], ".meg"))  strcpy_s(xyz, argv[i]); // Binary graph file, read by CreateSites in place of the .xyz and .edge files.
         if (strstr(argv[i], ".occ")) strcpy_s(occ, argv[i]);
         
         // Options
@@ -54,6 +387,14 @@ int main(int argc, char* argv[])
             }
         }
         if (strcmp(argv[i], "--rescale") == 0) rescale = true;
+        if (strcmp(argv[i], "--logRates") == 0) logDomain = true;
+        if (strcmp(argv[i], "--refine") == 0) refine = 3;
+        if (strstr(argv[i], "--refine="))
+        {
+            char* substr = strchr(argv[i], '=');
+            refine = std::max(atoi(++substr), 0);
+        }
+        if (strcmp(argv[i], "--denseAssembly") == 0) denseAssembly = true;
         if (strstr(argv[i], "--tol="))
         {
             char* substr = strchr(argv[i], '=');
@@ -64,6 +405,36 @@ int main(int argc, char* argv[])
             char* substr = strchr(argv[i], '=');
             transE = atof(++substr); // If not interpretable then atof will return 0.
         }
+        if (strstr(argv[i], "--solver="))
+        {
+            char* substr = strchr(argv[i], '=');
+            ++substr;
+            if (strcmp(substr, "bicgstab") == 0) solver = SolverForm::bicgstab;
+            else if (strcmp(substr, "gmres") == 0) solver = SolverForm::gmres;
+            else if (strcmp(substr, "svd") == 0) solver = SolverForm::svd;
+            else if (strcmp(substr, "arnoldi") == 0) solver = SolverForm::arnoldi;
+            else if (strcmp(substr, "direct") == 0) solver = SolverForm::direct;
+            else
+            {
+                std::cout << "***ERROR***: Unknown solver " << substr << ". Expected svd, bicgstab, gmres, arnoldi or direct.\n";
+                exit(-1);
+            }
+        }
+        if (strstr(argv[i], "--solverTol="))
+        {
+            char* substr = strchr(argv[i], '=');
+            solverTol = atof(++substr);
+        }
+        if (strstr(argv[i], "--maxIter="))
+        {
+            char* substr = strchr(argv[i], '=');
+            maxIter = atoi(++substr);
+        }
+        if (strstr(argv[i], "--threads="))
+        {
+            char* substr = strchr(argv[i], '=');
+            SetNumThreads(atoi(++substr)); // If not interpretable then atoi will return 0, i.e. the default.
+        }
         if (strstr(argv[i], "--propagate="))
         {
             char* substr = strchr(argv[i], '=');
@@ -79,52 +450,614 @@ int main(int argc, char* argv[])
                 token = strtok_s(NULL, ",",&next_token);
             }
         }
+        if (strstr(argv[i], "--transient="))
+        {
+            // End time and interval between records, e.g. --transient=1e-6,1e-9
+            char* substr = strchr(argv[i], '=');
+            ++substr;
+            transient.tEnd = atof(substr);
+            char* comma = strchr(substr, ',');
+            transient.interval = comma ? atof(++comma) : transient.tEnd;
+            if (transient.tEnd <= 0.0 || transient.interval <= 0.0)
+            {
+                std::cout << "***ERROR***: --transient expects a positive end time and record interval, e.g. --transient=1e-6,1e-9\n";
+                exit(-1);
+            }
+        }
+        if (strstr(argv[i], "--transientTol="))
+        {
+            char* substr = strchr(argv[i], '=');
+            transient.tol = atof(++substr);
+        }
+        if (strstr(argv[i], "--transientFile="))
+        {
+            char* substr = strchr(argv[i], '=');
+            transient.file = ++substr;
+        }
+        if (strstr(argv[i], "--initialField="))
+        {
+            char* substr = strchr(argv[i], '=');
+            initialField = atof(++substr);
+        }
+        if (strcmp(argv[i], "--resume") == 0) transient.resume = true;
+        if (strcmp(argv[i], "--noSplit") == 0) splitComponents = false;
+        if (strcmp(argv[i], "--mobilityTensor") == 0) mobilityTensor = true;
+        if (strcmp(argv[i], "--nearEquilibrium") == 0) balanceForm = BalanceForm::exact;
+        if (strcmp(argv[i], "--amg") == 0) krylovPrecond = KrylovPrecond::amg;
+        if (strstr(argv[i], "--nearEquilibrium="))
+        {
+            char* substr = strchr(argv[i], '=');
+            ++substr;
+            if (strcmp(substr, "exact") == 0) balanceForm = BalanceForm::exact;
+            else if (strcmp(substr, "incomplete") == 0) balanceForm = BalanceForm::incomplete;
+            else
+            {
+                std::cout << "***ERROR***: Unknown near equilibrium preconditioner " << substr << ". Expected exact or incomplete.\n";
+                exit(-1);
+            }
+        }
+        if (strstr(argv[i], "--reorder="))
+        {
+            char* substr = strchr(argv[i], '=');
+            ++substr;
+            if (strcmp(substr, "rcm") == 0) siteOrder = SiteOrder::rcm;
+            else if (strcmp(substr, "morton") == 0) siteOrder = SiteOrder::morton;
+            else if (strcmp(substr, "file") == 0) siteOrder = SiteOrder::file;
+            else
+            {
+                std::cout << "***ERROR***: Unknown site order " << substr << ". Expected file, rcm or morton.\n";
+                exit(-1);
+            }
+        }
+        if (strstr(argv[i], "--eigen="))
+        {
+            char* substr = strchr(argv[i], '=');
+            int k = atoi(++substr);
+            if (k > 0) eigen.k = k;
+        }
+        if (strstr(argv[i], "--profile="))
+        {
+            // JSON file of the time, memory and metrics of each stage of the calculation.
+            char* substr = strchr(argv[i], '=');
+            profile = ++substr;
+        }
+        if (strstr(argv[i], "--output="))
+        {
+            char* substr = strchr(argv[i], '=');
+            ++substr;
+            if (strcmp(substr, "full") == 0) output = OutputMode::full;
+            else if (strcmp(substr, "summary") == 0) output = OutputMode::summary;
+            else if (strcmp(substr, "quiet") == 0) output = OutputMode::quiet;
+            else
+            {
+                std::cout << "***ERROR***: Unknown output mode " << substr << ". Expected full, summary or quiet.\n";
+                exit(-1);
+            }
+        }
+        if (strstr(argv[i], "--flux="))
+        {
+            // Prefix of the flux map files, <prefix>.sites and <prefix>.edges.
+            char* substr = strchr(argv[i], '=');
+            fluxPrefix = ++substr;
+        }
+        if (strstr(argv[i], "--occFormat="))
+        {
+            char* substr = strchr(argv[i], '=');
+            ++substr;
+            if (strcmp(substr, "text") == 0) occFormat = OccFormat::text;
+            else if (strcmp(substr, "binary") == 0) occFormat = OccFormat::binary;
+            else
+            {
+                std::cout << "***ERROR***: Unknown occupation file format " << substr << ". Expected text or binary.\n";
+                exit(-1);
+            }
+        }
+        if (strstr(argv[i], "--eigenShift="))
+        {
+            char* substr = strchr(argv[i], '=');
+            eigen.shift = atof(++substr);
+        }
     }
+    transient.solverTol = solverTol;
+    transient.maxIter = maxIter;
+    if (!profile.empty())
+        StartProfile(profile, argc, argv);
+    keepOccupations = (occ[0] != '\0');
+
+    // Matrices are only printed in full.
+    if (output != OutputMode::full)
+        verbose = false;
 
     // Print options
-    std::cout << "Taking input from " << sim << ", " << xyz << ", " << edge << " ...\n";
-    std::cout << "Preconditioning ";
-    switch (form)
+    if (output != OutputMode::quiet)
     {
-        case transporter::PrecondForm::off: std::cout << "off\n"; break;
-        case transporter::PrecondForm::boltzmann: std::cout << "on, form = boltzmann\n"; break;
-        case transporter::PrecondForm::boltzmannSquared: std::cout << "on, form = boltzmannSquared\n"; break;
-        case transporter::PrecondForm::rateSum: std::cout << "on, form = rateSum\n"; break;
+        std::cout << "Taking input from " << sim << ", " << xyz << ", " << edge << " ...\n";
+        std::cout << "Preconditioning ";
+        switch (form)
+        {
+            case transporter::PrecondForm::off: std::cout << "off\n"; break;
+            case transporter::PrecondForm::boltzmann: std::cout << "on, form = boltzmann\n"; break;
+            case transporter::PrecondForm::boltzmannSquared: std::cout << "on, form = boltzmannSquared\n"; break;
+            case transporter::PrecondForm::rateSum: std::cout << "on, form = rateSum\n"; break;
+        }
+        std::cout << "Rescaling "; if (rescale) std::cout << "on\n"; else std::cout << "off\n";
+        if (logDomain) std::cout << "Rates assembled from logs\n";
+        if (refine > 0 && solver != SolverForm::svd && solver != SolverForm::arnoldi) std::cout << "Iterative refinement, up to " << refine << " steps\n";
+        std::cout << "Rate matrix assembly "; if (denseAssembly) std::cout << "dense\n"; else std::cout << "sparse\n";
+        std::cout << "Solver ";
+        switch (solver)
+        {
+            case SolverForm::svd: std::cout << "svd\n"; break;
+            case SolverForm::bicgstab: std::cout << "bicgstab, relative tolerance = " << solverTol << ", max iterations = " << maxIter << ", " << (krylovPrecond == KrylovPrecond::amg ? "AMG" : "Jacobi") << " preconditioner\n"; break;
+            case SolverForm::gmres: std::cout << "gmres, relative tolerance = " << solverTol << ", max iterations = " << maxIter << ", " << (krylovPrecond == KrylovPrecond::amg ? "AMG" : "Jacobi") << " preconditioner\n"; break;
+            case SolverForm::direct: std::cout << "direct (sparse LU, nested dissection ordering)\n"; break;
+            case SolverForm::arnoldi: std::cout << "arnoldi, " << eigen.k << " eigenvalues closest to zero, shift = " << eigen.shift << " x largest rate sum\n"; break;
+        }
+        if (solver == SolverForm::svd)
+        {
+            std::cout << "Singular value threshold = ";
+            if (tolerance == 0.0) std::cout << "auto\n"; else std::cout << tolerance << "\n";
+        }
+        if (!propagate.empty()) std::cout << "Testing time propagation of ";
+        for (size_t i = 0; i < propagate.size(); i++) std::cout << propagate[i] << "s ";
+        std::cout << "\n";
+        if (transient.tEnd > 0.0)
+        {
+            std::cout << "Transient from steady state at fieldZ = " << initialField << " V/Ang to t = " << transient.tEnd << " s, recording every " << transient.interval << " s to " << transient.file
+                << "\nTransient local error tolerance = " << transient.tol << "\n";
+            if (transient.resume) std::cout << "Resuming from checkpoint " << transient.file << ".chk\n";
+        }
+        std::cout << "Site order ";
+        switch (siteOrder)
+        {
+            case SiteOrder::file: std::cout << "file\n"; break;
+            case SiteOrder::rcm: std::cout << "reverse Cuthill-McKee\n"; break;
+            case SiteOrder::morton: std::cout << "Morton\n"; break;
+        }
+        if (mobilityTensor) std::cout << "Mobility tensor from fields along x, y and z\n";
+        std::cout << "Solve disconnected components separately "; if (splitComponents) std::cout << "on\n"; else std::cout << "off\n";
+        std::cout << "Zero field (detailed balance) preconditioning ";
+        switch (balanceForm)
+        {
+            case BalanceForm::off: std::cout << "off\n"; break;
+            case BalanceForm::exact: std::cout << "on, exact factorisation\n"; break;
+            case BalanceForm::incomplete: std::cout << "on, incomplete factorisation\n"; break;
+        }
+        std::cout << "Threads = " << NumThreads() << "\n";
+        if (!profile.empty()) std::cout << "Profile written to " << profile << "\n";
+        std::cout << "Verbosity "; if (verbose) std::cout << "high\n"; else std::cout << "low\n";
+        if (output != OutputMode::full) std::cout << "Output " << (output == OutputMode::summary ? "summary" : "quiet") << "\n";
+        if (!fluxPrefix.empty()) std::cout << "Flux map written to " << fluxPrefix << ".sites, " << fluxPrefix << ".edges\n";
+        if (keepOccupations) std::cout << "Occupations written to " << occ << (occFormat == OccFormat::binary ? " (binary)\n" : "\n");
     }
-    std::cout << "Rescaling "; if (rescale) std::cout << "on\n"; else std::cout << "off\n";
-    std::cout << "Singular value threshold = "; if (tolerance == 0.0) std::cout << "auto\n"; else std::cout << tolerance << "\n";
-    if (!propagate.empty()) std::cout << "Testing time propagation of "; for (int i = 0; i < propagate.size(); i++) { std::cout << propagate[i] << "s "; }; std::cout << "\n";
-    std::cout << "Verbosity "; if (verbose) std::cout << "high\n"; else std::cout << "low\n";
 
 
-    std::cout << "\nReading simulation parameters...\n";
-    const double F_z = ReadParameter(sim, label_F_z); // V/Ang
-    const double temp = ReadParameter(sim, label_T); // K
-    const double kBT = kB * temp; // eV
-    const double reorg = ReadParameter(sim, label_reorg); // eV
+    const bool quiet = (output == OutputMode::quiet);
+    if (!quiet) std::cout << "\nReading simulation parameters...\n";
+    const std::vector<double> fields = ReadParameterList(sim, label_F_z); // V/Ang
+    const std::vector<double> temps = ReadParameterList(sim, label_T); // K
+    const std::vector<double> reorgs = ReadParameterList(sim, label_reorg); // eV
+    const double xsize = ReadParameterDefaultValue(sim, label_periodicX, -1.0); // Ang
+    const double ysize = ReadParameterDefaultValue(sim, label_periodicY, -1.0); // Ang
     const double zsize = ReadParameterDefaultValue(sim, label_periodic, -1.0); // Ang
-    if (zsize != -1.0) periodic = true;
+    if (xsize != -1.0) box.X = xsize;
+    if (ysize != -1.0) box.Y = ysize;
+    if (zsize != -1.0) box.Z = zsize;
+    const double F_x = ReadParameterDefaultValue(sim, label_F_x, 0.0); // V/Ang
+    const double F_y = ReadParameterDefaultValue(sim, label_F_y, 0.0); // V/Ang
+    const bool sweep = fields.size() * temps.size() * reorgs.size() > 1;
 
-    std::cout << "fieldZ (V/Ang) = " << F_z
-        << "\ntemp (K) = " << temp
-        << "\nreorg (eV) = " << reorg;
-    if (periodic) std::cout << "\nPeriodic in z, zsize (Ang) = " << zsize;
-    std::cout << "\n";
+    const double F_z = fields[0]; // V/Ang
+    const double temp = temps[0]; // K
+    const double kBT = kB * temp; // eV
+    const double reorg = reorgs[0]; // eV
+
+    if (!quiet)
+    {
+        if (sweep)
+            std::cout << "Sweeping " << fields.size() << " fieldZ x " << temps.size() << " temp x " << reorgs.size() << " reorg values";
+        else
+            std::cout << "fieldZ (V/Ang) = " << F_z
+                << "\ntemp (K) = " << temp
+                << "\nreorg (eV) = " << reorg;
+        if (F_x != 0.0 || F_y != 0.0) std::cout << "\nfieldX (V/Ang) = " << F_x << "\nfieldY (V/Ang) = " << F_y;
+        if (box.X > 0.0) std::cout << "\nPeriodic in x, xsize (Ang) = " << xsize;
+        if (box.Y > 0.0) std::cout << "\nPeriodic in y, ysize (Ang) = " << ysize;
+        if (zsize != -1.0) std::cout << "\nPeriodic in z, zsize (Ang) = " << zsize;
+        std::cout << "\n";
 
-    std::cout << "\nCreating sites...\n";
-    std::vector<site> allSites = CreateSites(xyz, edge);
+        std::cout << "\nCreating sites...\n";
+    }
+    siteGraph graph;
+    profileStage parseStage("parse");
+    std::vector<site> allSites = CreateSites(xyz, edge, graph);
     const size_t M = allSites.size(); // # sites
-    for (int i = 0; i < M; i++)
-        std::cout << allSites[i] << std::endl;
+    parseStage.Set("sites", M);
+    parseStage.Set("pairs", graph.numEdges() / 2);
+    parseStage.End();
+    profileStage graphStage("graph");
+    graph.SetGeometry(allSites, box);
+    graphStage.End();
+    if (sweep || output != OutputMode::full)
+    {
+        if (!quiet) std::cout << M << " sites, " << graph.numEdges() / 2 << " interacting pairs\n";
+    }
+    else
+    {
+        // As operator<< for each site, buffered.
+        outputBuffer out(std::cout);
+        for (size_t i = 0; i < M; i++)
+            out.line("pos = (%g,%g,%g); E = %g; # neighbors = %zu\n", allSites[i].pos.X, allSites[i].pos.Y, allSites[i].pos.Z, allSites[i].energy, graph.degree(i));
+    }
+
+    profileStage orderStage("ordering");
+    if (siteOrder != SiteOrder::file)
+    {
+        // Renumber the sites so neighbours are close together in memory. Per-site output is mapped back to the file order.
+        size_t bandwidth = Bandwidth(graph);
+        std::vector<size_t> order = (siteOrder == SiteOrder::rcm) ? ReverseCuthillMcKee(graph) : MortonOrder(allSites);
+        PermuteSites(allSites, graph, order);
+        siteIndex.resize(M);
+        for (size_t i = 0; i < M; i++)
+            siteIndex[order[i]] = i;
+        transient.outputIndex = siteIndex;
+        std::cout << "Sites reordered, rate matrix bandwidth " << bandwidth << " -> " << Bandwidth(graph) << "\n";
+    }
+
+    std::vector<size_t> component;
+    const size_t numComponents = ConnectedComponents(graph, component);
+    orderStage.Set("components", numComponents);
+    orderStage.End();
+
+    if (sweep && transient.tEnd > 0.0)
+    {
+        std::cout << "***ERROR***: --transient needs a single value of each simulation parameter.\n";
+        exit(-1);
+    }
+    if (sweep && mobilityTensor)
+    {
+        std::cout << "***ERROR***: --mobilityTensor needs a single value of each simulation parameter.\n";
+        exit(-1);
+    }
+
+    // Sweeps, the mobility tensor and transients find steady states with BiCGSTAB in place of SVD or Arnoldi iteration.
+    const bool krylovSteadyState = solver == SolverForm::bicgstab || solver == SolverForm::gmres
+        || (solver != SolverForm::direct && (sweep || mobilityTensor || transient.tEnd > 0.0));
+    if (krylovPrecond == KrylovPrecond::amg && !krylovSteadyState)
+        std::cout << "***WARNING***: --amg only preconditions the iterative solvers (bicgstab, gmres), so is ignored by the " << solverName(solver) << " solver.\n";
+
+    if (numComponents > 1)
+        std::cout << "Sites form " << numComponents << " disconnected components\n";
+
+    if (sweep)
+    {
+        if (numComponents > 1)
+            std::cout << "***WARNING***: The steady state of a disconnected system is not unique, sweep results may be unreliable.\n";
+        if (keepOccupations || !fluxPrefix.empty())
+            std::cout << "***WARNING***: No occupation file or flux map is written for a sweep.\n";
+
+        // Solve every combination of parameters, sharing the graph. The dense SVD is too costly to repeat, so use a sparse solver.
+        sweepSettings settings;
+        settings.transE = transE;
+        settings.fieldX = F_x;
+        settings.fieldY = F_y;
+        settings.form = form;
+        settings.solver = (solver == SolverForm::gmres || solver == SolverForm::direct) ? solver : SolverForm::bicgstab;
+        settings.tol = solverTol;
+        settings.maxIter = maxIter;
+        settings.balance = balanceForm;
+        settings.precond = krylovPrecond;
+        settings.refine = refine;
+        settings.logDomain = logDomain;
+        if (Profiling())
+            settings.stage = startSweepStage;
+
+        std::vector<sweepPoint> points = SweepPoints(fields, temps, reorgs);
+        if (!quiet) std::cout << "\nSolving ME at " << points.size() << " points using " << solverName(settings.solver) << "...\n\n";
+        profileStage stage("sweep");
+        std::vector<sweepResult> results = RunSweep(allSites, graph, points, settings);
+        int iterations = 0;
+        double residual = 0.0;
+        for (size_t p = 0; p < results.size(); p++)
+        {
+            iterations += results[p].info.iterations;
+            residual = std::max(residual, results[p].info.residual);
+        }
+        stage.Set("points", points.size());
+        stage.Set("iterations", iterations);
+        stage.Set("maxResidual", residual);
+        stage.End();
+        printSweep(points, results, settings);
+
+        return 0;
+    }
 
     // Create transporter object
-    transporter transport(kBT, F_z, reorg, transE, periodic, zsize);
+    profileStage rateStage("rates");
+    transporter transport(allSites, graph, kBT, F_x, F_y, F_z, reorg, transE, logDomain);
+    rateStage.Set("edges", graph.numEdges());
+    rateStage.End();
+    if (verbose)
+        std::cout << "\nRates evaluated with " << MarcusRatesISA() << " kernel, max relative deviation from scalar formula = " << transport.CheckRates() << "\n";
+
+    if (mobilityTensor)
+    {
+        // Column b of the tensor is the velocity of the steady state with a field of the same strength along axis b, divided by that field.
+        const double F = std::sqrt(F_x * F_x + F_y * F_y + F_z * F_z);
+        if (F == 0.0)
+        {
+            std::cout << "***ERROR***: --mobilityTensor needs a non-zero field.\n";
+            exit(-1);
+        }
+        const SolverForm tensorSolver = (solver == SolverForm::gmres || solver == SolverForm::direct) ? solver : SolverForm::bicgstab;
+        if (!quiet) std::cout << "\nSolving ME with a field of " << F << " V/Ang along x, y and z using " << solverName(tensorSolver) << "...\n";
+
+        double mob[3][3];
+        for (int b = 0; b < 3; b++)
+        {
+            transport.SetField(b == 0 ? F : 0.0, b == 1 ? F : 0.0, b == 2 ? F : 0.0);
+            sparseMatrix A = transport.CreateSparseRateMatrix(form, false, false);
+            std::vector<double> P;
+            profileStage stage("solve");
+            solveInfo info = SteadyState(A, P, tensorSolver, solverTol, maxIter, krylovPrecond, refine);
+            setSolveMetrics(stage, info);
+            stage.End();
+            if (!info.converged)
+                std::cout << "***WARNING***: Solver did not converge to the requested tolerance with the field along " << "xyz"[b] << ".\n";
+            reversePreconditioning(transport, P);
+
+            double v[3];
+            transport.Velocity(P, v[0], v[1], v[2]);
+            for (int a = 0; a < 3; a++)
+                mob[a][b] = v[a] / F;
+        }
 
-    if (form != transporter::PrecondForm::off) std::cout << "\nCreating preconditioned rate matrix A...\n";
-    else std::cout << "\nCreating rate matrix A...\n";
-    gsl_matrix* A = transport.CreateRateMatrix(allSites, form, rescale, verbose);
+        // Along an axis that isn't periodic, charge can't flow in the steady state, so those elements vanish.
+        std::cout << "\nmobility tensor (cm^2 / V*s), rows velocity x, y, z, columns field x, y, z\n";
+        for (int a = 0; a < 3; a++)
+            std::cout << std::setw(16) << std::left << mob[a][0] * 1e-16 << std::setw(16) << mob[a][1] * 1e-16 << mob[a][2] * 1e-16 << "\n";
+
+        return 0;
+    }
+
+    if (transient.tEnd > 0.0)
+    {
+        // Start from the steady state at the initial field, then follow the relaxation after switching to fieldZ.
+        std::vector<double> P;
+        if (!transient.resume)
+        {
+            if (!quiet) std::cout << "\nFinding initial steady state at fieldZ = " << initialField << " V/Ang...\n";
+            transport.SetFieldZ(initialField);
+            sparseMatrix A0 = transport.CreateSparseRateMatrix(form, false, false);
+            profileStage stage("solve");
+            solveInfo info = SteadyState(A0, P, (solver == SolverForm::gmres || solver == SolverForm::direct) ? solver : SolverForm::bicgstab, solverTol, maxIter, krylovPrecond, refine);
+            setSolveMetrics(stage, info);
+            stage.End();
+            if (!info.converged)
+                std::cout << "***WARNING***: Solver did not converge to the requested tolerance.\n";
+            reversePreconditioning(transport, P);
+            transport.SetFieldZ(F_z);
+        }
 
-    std::cout << "\nSolving ME using SVD...\n";
+        if (!quiet) std::cout << "\nIntegrating ME with TR-BDF2...\n";
+        sparseMatrix A = transport.CreateSparseRateMatrix(transporter::PrecondForm::off, false, false);
+        profileStage stage("transient");
+        transientInfo info = RunTransient(transport, A, P, transient);
+        stage.Set("steps", info.steps);
+        stage.Set("rejected", info.rejected);
+        stage.End();
+        std::cout << "Reached t = " << info.t << " s in " << info.steps << " steps (" << info.rejected << " rejected), " << info.records << " records written\n";
+        if (!info.completed)
+            std::cout << "***WARNING***: Integration stopped before the requested end time.\n";
+
+        reportOccupations(transport, allSites, P, NULL);
+        writeFluxMap(transport, allSites, graph, P, 1);
+        writeOccupations(occ, allSites);
+
+        printVelocity(velocity(transport, P), F_x, F_y, F_z);
+
+        return 0;
+    }
+
+    if (solver == SolverForm::arnoldi)
+    {
+        // The eigenvalues of a preconditioned matrix are not relaxation rates, so use the plain rate matrix.
+        if (!quiet) std::cout << "\nCreating rate matrix A...\n";
+        sparseMatrix A = transport.CreateSparseRateMatrix(transporter::PrecondForm::off, false, verbose);
+
+        if (!quiet) std::cout << "\nFinding the " << eigen.k << " eigenvalues of A closest to zero by shift-invert Arnoldi...\n";
+        eigen.solverTol = std::min(solverTol, 1e-12);
+        eigen.maxIter = maxIter;
+        std::vector<eigenPair> pairs;
+        profileStage stage("eigen");
+        eigenInfo info = SmallestEigenpairs(A, pairs, eigen);
+        stage.Set("solves", info.solves);
+        stage.Set("restarts", info.restarts);
+        stage.End();
+        std::cout << "Shift (1/s) = " << info.shift << "\nRestarts = " << info.restarts << "\nLinear solves = " << info.solves << "\n";
+        if (!info.converged)
+            std::cout << "***WARNING***: Only " << pairs.size() << " eigenvalues converged.\n";
+
+        std::cout << "\nEigenvalues (1/s)\n";
+        for (size_t p = 0; p < pairs.size(); p++)
+        {
+            std::cout << pairs[p].re;
+            if (pairs[p].im != 0.0) std::cout << (pairs[p].im > 0 ? " + " : " - ") << std::abs(pairs[p].im) << "i";
+            std::cout << "   (residual " << pairs[p].residual << ")\n";
+        }
+
+        // Eigenvalues within the accuracy of the shift-invert iteration are taken to be zero, each giving a steady state.
+        double threshold = (tolerance == 0.0) ? std::sqrt(eigen.tol) * info.shift : tolerance;
+        size_t numSteady = 0;
+        while (numSteady < pairs.size() && std::hypot(pairs[numSteady].re, pairs[numSteady].im) <= threshold)
+            numSteady++;
+        std::cout << "\nDisregarding eigenvalues greater than threshold = " << threshold << "\n";
+        std::cout << "Steady states = " << numSteady << "\n";
+        if (numSteady > 1)
+            std::cout << "***WARNING***: The steady state is not unique, the sites form disconnected clusters.\n";
+        if (numSteady < pairs.size())
+            std::cout << "Spectral gap (1/s) = " << std::abs(pairs[numSteady].re) << "\nRelaxation time (s) = " << 1.0 / std::abs(pairs[numSteady].re) << "\n";
+        else
+            std::cout << "Spectral gap not found among the " << pairs.size() << " eigenvalues, increase --eigen\n";
+
+        std::cout << "Printing possible solutions\n";
+        for (size_t p = 0; p < numSteady; p++)
+        {
+            std::cout << "\n\nPossible solution " << p + 1 << " : eigenvalue = " << pairs[p].re << "\n";
+            std::vector<double>& P = pairs[p].vec;
+
+            // Eigenvectors have unit 2-norm, so normalise so values add to 1, as the other solvers do (which also fixes the sign)
+            NormaliseSteadyState(P);
+
+            reportOccupations(transport, allSites, P, "\nOccupation probabilities\n");
+            writeFluxMap(transport, allSites, graph, P, (int)p + 1);
+
+            if (!propagate.empty())
+                propagateDensities(A, P);
+
+            printVelocity(velocity(transport), F_x, F_y, F_z);
+        }
+        writeOccupations(occ, allSites);
+
+        return 0;
+    }
+
+    if (numComponents > 1 && splitComponents)
+    {
+        if (!quiet) std::cout << "\nSolving ME for each component using " << solverName(solver) << "...\n";
+        profileStage stage("solve");
+        std::vector<double> P = solveComponents(allSites, graph, component, numComponents, kBT, F_x, F_y, F_z, reorg);
+        stage.Set("components", numComponents);
+        stage.End();
+
+        reportOccupations(transport, allSites, P, "\nOccupation probabilities\n");
+        writeFluxMap(transport, allSites, graph, P, 1);
+        writeOccupations(occ, allSites);
+
+        if (!propagate.empty())
+            propagateDensities(transport.CreateSparseRateMatrix(transporter::PrecondForm::off, false, false), P);
+
+        printVelocity(velocity(transport), F_x, F_y, F_z);
+
+        return 0;
+    }
+
+    if (!quiet)
+        std::cout << (form != transporter::PrecondForm::off ? "\nCreating preconditioned rate matrix A...\n" : "\nCreating rate matrix A...\n");
+
+    if (solver != SolverForm::svd)
+    {
+        profileStage assemblyStage("assembly");
+        sparseMatrix A = transport.CreateSparseRateMatrix(form, rescale, verbose);
+        assemblyStage.Set("nnz", A.nnz());
+        assemblyStage.End();
+
+        // Rates that satisfy detailed balance (no field along a periodic axis) give a symmetrisable rate matrix.
+        // The unconditioned rate matrix is only needed to check for it, or for near equilibrium preconditioning.
+        const bool nearEquilibrium = balanceForm != BalanceForm::off && solver != SolverForm::direct;
+        sparseMatrix A0;
+        std::vector<double> logPi;
+        bool balanced = false;
+        if (nearEquilibrium || transport.FieldHasPotential())
+        {
+            A0 = transport.CreateSparseRateMatrix(transporter::PrecondForm::off, false, false);
+            logPi.resize(M);
+            for (size_t j = 0; j < M; j++)
+                logPi[j] = transport.LogBoltzmannFactor(j);
+            balanced = DetailedBalanceError(A0, logPi) <= detailedBalanceTol;
+        }
+        bool symmetric = false;
+
+        std::vector<double> P;
+        solveInfo info;
+        profileStage solveStage("solve");
+        if (balanced || nearEquilibrium)
+        {
+            if (balanced)
+            {
+                if (!quiet) std::cout << "\nRates satisfy detailed balance, solving symmetrised ME using CG...\n";
+                info = SymmetricSteadyState(A0, logPi, P, solverTol, maxIter);
+                symmetric = true;
+            }
+            else
+            {
+                // Precondition with the pinned system at zero field, close to that at a small field.
+                transporter equilibrium(allSites, graph, kBT, 0.0, reorg, transE, logDomain);
+                sparseMatrix Aeq = equilibrium.CreateSparseRateMatrix(transporter::PrecondForm::off, false, false);
+                std::vector<double> logPiEq(M);
+                for (size_t j = 0; j < M; j++)
+                    logPiEq[j] = equilibrium.LogBoltzmannFactor(j);
+                luSymbolic symbolic(Aeq, balanceForm == BalanceForm::exact);
+                detailedBalancePreconditioner Meq(Aeq, logPiEq, symbolic);
+                if (Meq.Factored())
+                {
+                    if (!quiet) std::cout << "\nSolving ME using " << solverName(solver) << ", preconditioned by the zero field rate matrix (" << symbolic.nnzSymmetricFactors() << " non-zero elements of factors)...\n";
+                    info = SteadyState(A0, P, solver, solverTol, maxIter, Meq.Pinned(), Meq, refine);
+                    symmetric = true;
+                }
+                else
+                    std::cout << "***WARNING***: Zero field rate matrix is singular. Solving without near equilibrium preconditioning.\n";
+            }
+            if (symmetric)
+                std::cout << "Iterations = " << info.iterations << "\n";
+        }
+
+        if (!symmetric)
+        {
+            if (solver == SolverForm::direct)
+            {
+                if (!quiet) std::cout << "\nSolving ME using " << solverName(solver) << "...\n";
+                profileStage analysisStage("analysis");
+                luSymbolic symbolic(A);
+                analysisStage.Set("factorNnz", symbolic.nnzFactors());
+                analysisStage.End();
+                std::cout << "Non-zero elements of factors = " << symbolic.nnzFactors() << " (rate matrix " << A.nnz() << ")\n";
+                info = DirectSteadyState(A, P, symbolic, solverTol, refine);
+            }
+            else
+            {
+                if (!quiet) std::cout << "\nSolving ME using " << solverName(solver) << "...\n";
+                info = SteadyState(A, P, solver, solverTol, maxIter, krylovPrecond, refine);
+                std::cout << "Iterations = " << info.iterations << "\n";
+            }
+        }
+        setSolveMetrics(solveStage, info);
+        solveStage.End();
+        std::cout << "Relative residual = " << info.residual << "\n";
+        if (refine > 0 && !balanced)
+            std::cout << "Refinement steps = " << info.refinements << ", componentwise backward error = " << info.backwardError << "\n";
+        if (!info.converged)
+            std::cout << "***WARNING***: Solver did not converge to the requested tolerance.\n";
+
+        // The symmetric paths solve the unconditioned rate matrix.
+        if (!symmetric)
+            reversePreconditioning(transport, P);
+
+        reportOccupations(transport, allSites, P, "\nOccupation probabilities\n");
+        writeFluxMap(transport, allSites, graph, P, 1);
+        writeOccupations(occ, allSites);
+
+        if (!propagate.empty())
+        {
+            // Need the non-conditioned, non-scaled rate matrix for time propogation.
+            propagateDensities(transport.CreateSparseRateMatrix(transporter::PrecondForm::off, false, false), P);
+        }
+
+        printVelocity(velocity(transport), F_x, F_y, F_z);
+
+        return 0;
+    }
+
+    profileStage assemblyStage("assembly");
+    gsl_matrix* A;
+    if (denseAssembly)
+        A = transport.CreateRateMatrix(form, rescale, verbose);
+    else
+        A = transport.CreateSparseRateMatrix(form, rescale, verbose).toDense();
+    assemblyStage.Set("nnz", (double)M * M);
+    assemblyStage.End();
+
+    if (!quiet) std::cout << "\nSolving ME using SVD...\n";
     gsl_matrix* U = gsl_matrix_alloc(M, M);
     gsl_matrix* V = gsl_matrix_alloc(M, M);
     gsl_matrix* VT = gsl_matrix_alloc(M, M);
@@ -136,13 +1069,15 @@ int main(int argc, char* argv[])
     gsl_matrix* UxSigmaxVT = gsl_matrix_alloc(M, M);
     gsl_vector* AxP = gsl_vector_alloc(M);
 
+    profileStage solveStage("solve");
     gsl_matrix_memcpy(U, A);
     gsl_linalg_SV_decomp(U, V, S, work);
+    solveStage.End();
     gsl_matrix_transpose_memcpy(VT, V);
 
     //Create Sigma matrix
     gsl_matrix_set_zero(Sigma);
-    for (int i = 0; i < M; i++)
+    for (size_t i = 0; i < M; i++)
         gsl_matrix_set(Sigma, i, i, gsl_vector_get(S, i));
 
     if (verbose)
@@ -151,8 +1086,13 @@ int main(int argc, char* argv[])
         printMatrix(U);
     }
 
-    std::cout << "\nSingular values = \n";
-    printVector(S, false);
+    if (output == OutputMode::full)
+    {
+        std::cout << "\nSingular values = \n";
+        printVector(S, false);
+    }
+    else
+        std::cout << "\nSmallest singular value = " << gsl_vector_get(S, M - 1) << "\n";
 
     if (verbose)
     {
@@ -177,9 +1117,12 @@ int main(int argc, char* argv[])
 
     std::cout << "\n\nDisregarding singular values greater than threshold = " << tolerance << "\n";
     std::cout << "Printing possible solutions\n";
-    gsl_matrix* cleanA = transport.CreateRateMatrix(allSites, transporter::PrecondForm::off, false, false); // Need the non-conditioned, non-scaled rate matrix for time propogation and velocity calculations.
+    // Need the non-conditioned, non-scaled rate matrix for time propogation.
+    sparseMatrix cleanA;
+    if (!propagate.empty())
+        cleanA = transport.CreateSparseRateMatrix(transporter::PrecondForm::off, false, false);
     int solnum = 0;
-    for (int i = 0; i < S->size; i++)
+    for (size_t i = 0; i < S->size; i++)
     {
         double sval = gsl_vector_get(S, i);
         if (sval <= tolerance)
@@ -188,55 +1131,26 @@ int main(int argc, char* argv[])
             std::cout << "\n\nPossible solution " << solnum << " : singular value = " << sval << "\n";
 
             gsl_matrix_get_col(Q, V, i);
-            if (form != transporter::PrecondForm::off) {
+            if (form != transporter::PrecondForm::off && output == OutputMode::full)
+            {
                 std::cout << "\nConditioned densities\n";
-                printVector(Q);
-
-                // Reverse preconditioning
-                for (int j = 0; j < Q->size; j++)      
-                    gsl_vector_set(Q, j, gsl_vector_get(Q, j) * transport.PrecondFactor(&allSites[j], form));
-
-                // Renormalise so squared values add to 1
-                normalise(Q);
+                printSiteVector(Q);
             }
 
-            // If largest value is negative then flip all signs.
-            if (abs(gsl_vector_min(Q)) > gsl_vector_max(Q)) gsl_vector_scale(Q, -1.0);
-
-            std::cout << "\nOccupation densities\n";
-            for (int j = 0; j < Q->size; j++)
-                allSites[j].occProb = gsl_vector_get(Q, j);
-            printOccProbs(allSites, 6);
+            // Reverse preconditioning and normalise so values add to 1, as the sparse solvers do (which also fixes the sign)
+            std::vector<double> P(Q->size);
+            for (size_t j = 0; j < P.size(); j++)
+                P[j] = gsl_vector_get(Q, j);
+            transport.RemovePreconditioning(P, form);
+            NormaliseSteadyState(P);
+            reportOccupations(transport, allSites, P, "\nOccupation probabilities\n");
+            writeFluxMap(transport, allSites, graph, P, solnum);
 
             // Propagate densities in time (Can be useful to check if the solution is steady state).
             if (!propagate.empty())
-            {
-                std::cout << "\nTime propagation\n";
-                gsl_matrix* Axt = gsl_matrix_alloc(M,M);
-                gsl_matrix* expAxt = gsl_matrix_alloc(M, M);
-                gsl_vector* Qt = gsl_vector_alloc(M);
-                for (int i = 0; i < propagate.size(); i++)
-                {
-                    gsl_matrix_memcpy(Axt, cleanA);
-                    gsl_matrix_scale(Axt, propagate[i]);
-                    gsl_linalg_exponential_ss(Axt, expAxt, GSL_PREC_DOUBLE);
-                    gsl_blas_dgemv(CblasNoTrans, 1.0, expAxt, Q, 0.0, Qt);
-                    std::cout << "\nP( " << propagate[i] << "s ) = \n";
-                    printVector(Qt);
-                }
-                gsl_matrix_free(Axt);
-                gsl_matrix_free(expAxt);
-                gsl_vector_free(Qt);
-            }
+                propagateDensities(cleanA, P);
 
-            double v_z = transport.velocity_z(allSites, cleanA);
-            std::cout << "\nvelocity_z (Ang/s) = " << v_z << " \n";
-            if (F_z != 0.0) 
-            {
-                double mob = v_z / F_z;
-                std::cout << "mobility (Ang^2 / V*s)= " << mob << "\n";
-                std::cout << "mobility (cm^2 / V*s)= " << mob * 1e-16 << "\n";
-            }
+            printVelocity(velocity(transport), F_x, F_y, F_z);
 
             
             //if (verbose)
@@ -249,8 +1163,9 @@ int main(int argc, char* argv[])
         }
     }
 
+    writeOccupations(occ, allSites);
+
     // Free memory
-    gsl_matrix_free(cleanA);
     gsl_matrix_free(A);
     gsl_matrix_free(U);
     gsl_matrix_free(V);
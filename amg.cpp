@@ -0,0 +1,255 @@
+#include "pch.h"
+#include "amg.h"
+
+namespace
+{
+    const size_t none = std::numeric_limits<size_t>::max();
+
+    // Group the rows of A into aggregates of strongly coupled rows, setting aggregate[i] for every row.
+    // Returns the number of aggregates.
+    size_t aggregateRows(const sparseMatrix& A, double strength, std::vector<size_t>& aggregate)
+    {
+        const size_t n = A.size;
+        std::vector<double> diag(n);
+        for (size_t i = 0; i < n; i++)
+            diag[i] = std::abs(A.get(i, i));
+
+        // Strong couplings, made symmetric, with the larger of the two jump probabilities as the weight.
+        std::vector<size_t> start(n + 1, 0);
+        std::vector<std::pair<size_t, size_t>> pairs;
+        for (size_t i = 0; i < n; i++)
+            for (size_t k = A.rowStart[i]; k < A.rowStart[i + 1]; k++)
+            {
+                size_t j = A.col[k];
+                if (j != i && std::abs(A.val[k]) >= strength * diag[j] && diag[j] > 0.0)
+                {
+                    pairs.push_back({ i, j });
+                    pairs.push_back({ j, i });
+                }
+            }
+        std::sort(pairs.begin(), pairs.end());
+        pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+        std::vector<size_t> strong(pairs.size());
+        for (size_t p = 0; p < pairs.size(); p++)
+        {
+            start[pairs[p].first + 1]++;
+            strong[p] = pairs[p].second;
+        }
+        for (size_t i = 0; i < n; i++)
+            start[i + 1] += start[i];
+
+        auto weight = [&](size_t i, size_t j)
+        {
+            double w = 0.0;
+            if (diag[j] > 0.0) w = std::max(w, std::abs(A.get(i, j)) / diag[j]);
+            if (diag[i] > 0.0) w = std::max(w, std::abs(A.get(j, i)) / diag[i]);
+            return w;
+        };
+
+        aggregate.assign(n, none);
+        size_t numAggregates = 0;
+
+        // First pass: a row whose strong neighbours are all unaggregated forms an aggregate with them.
+        for (size_t i = 0; i < n; i++)
+        {
+            if (aggregate[i] != none || start[i] == start[i + 1]) continue;
+            bool free = true;
+            for (size_t k = start[i]; k < start[i + 1] && free; k++)
+                free = aggregate[strong[k]] == none;
+            if (!free) continue;
+
+            aggregate[i] = numAggregates;
+            for (size_t k = start[i]; k < start[i + 1]; k++)
+                aggregate[strong[k]] = numAggregates;
+            numAggregates++;
+        }
+
+        // Second pass: remaining rows join the aggregate of their most strongly coupled neighbour from the first pass.
+        std::vector<size_t> first = aggregate;
+        for (size_t i = 0; i < n; i++)
+        {
+            if (aggregate[i] != none) continue;
+            double best = 0.0;
+            for (size_t k = start[i]; k < start[i + 1]; k++)
+            {
+                size_t j = strong[k];
+                if (first[j] != none && weight(i, j) > best)
+                {
+                    best = weight(i, j);
+                    aggregate[i] = first[j];
+                }
+            }
+        }
+
+        // Third pass: anything left forms an aggregate with its unaggregated strong neighbours, or on its own.
+        for (size_t i = 0; i < n; i++)
+        {
+            if (aggregate[i] != none) continue;
+            aggregate[i] = numAggregates;
+            for (size_t k = start[i]; k < start[i + 1]; k++)
+                if (aggregate[strong[k]] == none) aggregate[strong[k]] = numAggregates;
+            numAggregates++;
+        }
+
+        return numAggregates;
+    }
+
+    // Ac = P^T A P, where P(i, I) = 1 if row i is in aggregate I.
+    void galerkin(const sparseMatrix& A, const std::vector<size_t>& aggregate, size_t numAggregates, sparseMatrix& Ac)
+    {
+        // Rows of each aggregate
+        std::vector<size_t> start(numAggregates + 1, 0), rows(A.size);
+        for (size_t i = 0; i < A.size; i++)
+            start[aggregate[i] + 1]++;
+        for (size_t I = 0; I < numAggregates; I++)
+            start[I + 1] += start[I];
+        std::vector<size_t> next(start.begin(), start.end() - 1);
+        for (size_t i = 0; i < A.size; i++)
+            rows[next[aggregate[i]]++] = i;
+
+        Ac.size = numAggregates;
+        Ac.rowStart.assign(numAggregates + 1, 0);
+        Ac.col.clear();
+        Ac.val.clear();
+        std::vector<size_t> position(numAggregates, none);
+        std::vector<std::pair<size_t, double>> row;
+        for (size_t I = 0; I < numAggregates; I++)
+        {
+            row.clear();
+            for (size_t p = start[I]; p < start[I + 1]; p++)
+                for (size_t k = A.rowStart[rows[p]]; k < A.rowStart[rows[p] + 1]; k++)
+                {
+                    size_t J = aggregate[A.col[k]];
+                    if (position[J] == none)
+                    {
+                        position[J] = row.size();
+                        row.push_back({ J, 0.0 });
+                    }
+                    row[position[J]].second += A.val[k];
+                }
+
+            std::sort(row.begin(), row.end());
+            Ac.rowStart[I] = Ac.col.size();
+            for (size_t e = 0; e < row.size(); e++)
+            {
+                Ac.col.push_back(row[e].first);
+                Ac.val.push_back(row[e].second);
+                position[row[e].first] = none;
+            }
+        }
+        Ac.rowStart[numAggregates] = Ac.col.size();
+    }
+
+    // Gauss-Seidel sweep through the rows of A x = b, forwards or backwards.
+    void gaussSeidel(const sparseMatrix& A, const std::vector<double>& rdiag, const std::vector<double>& b, std::vector<double>& x, bool forward)
+    {
+        const size_t n = A.size;
+        for (size_t c = 0; c < n; c++)
+        {
+            size_t i = forward ? c : n - 1 - c;
+            double sum = b[i];
+            for (size_t k = A.rowStart[i]; k < A.rowStart[i + 1]; k++)
+                if (A.col[k] != i) sum -= A.val[k] * x[A.col[k]];
+            x[i] = sum * rdiag[i];
+        }
+    }
+}
+
+amgPreconditioner::amgPreconditioner(const sparseMatrix& A, const amgSettings& settings) :
+    _coarseSweeps(settings.coarseSweeps),
+    _smoothSteps(settings.smoothSteps)
+{
+    _levels.push_back(level());
+    _levels[0].A = A;
+    while (true)
+    {
+        level& fine = _levels.back();
+        const size_t n = fine.A.size;
+        fine.rdiag.assign(n, 1.0);
+        for (size_t i = 0; i < n; i++)
+        {
+            double d = fine.A.get(i, i);
+            if (d != 0.0) fine.rdiag[i] = 1.0 / d;
+        }
+
+        if (n <= settings.coarseSize || (int)_levels.size() >= settings.maxLevels)
+            break;
+
+        std::vector<size_t> aggregate;
+        size_t numAggregates = aggregateRows(fine.A, settings.strength, aggregate);
+        if (numAggregates > 0.75 * n)
+            break; // Coarsening has stalled, e.g. no strong couplings remain
+
+        level coarse;
+        galerkin(fine.A, aggregate, numAggregates, coarse.A);
+        fine.aggregate.swap(aggregate);
+        _levels.push_back(std::move(coarse));
+    }
+
+    const sparseMatrix& Ac = _levels.back().A;
+    if (Ac.size <= settings.maxDense)
+    {
+        _coarseLU = Ac.toDense();
+        _coarsePerm = gsl_permutation_alloc(Ac.size);
+        int signum;
+        gsl_linalg_LU_decomp(_coarseLU, _coarsePerm, &signum);
+    }
+}
+
+amgPreconditioner::~amgPreconditioner()
+{
+    if (_coarseLU) gsl_matrix_free(_coarseLU);
+    if (_coarsePerm) gsl_permutation_free(_coarsePerm);
+}
+
+double amgPreconditioner::OperatorComplexity() const
+{
+    size_t total = 0;
+    for (size_t l = 0; l < _levels.size(); l++)
+        total += _levels[l].A.nnz();
+    return (double)total / _levels[0].A.nnz();
+}
+
+void amgPreconditioner::apply(const std::vector<double>& r, std::vector<double>& z) const
+{
+    z.assign(r.size(), 0.0);
+    cycle(0, r, z);
+}
+
+void amgPreconditioner::cycle(size_t l, const std::vector<double>& b, std::vector<double>& x) const
+{
+    const level& lev = _levels[l];
+    const size_t n = lev.A.size;
+
+    if (l + 1 == _levels.size())
+    {
+        if (_coarseLU)
+        {
+            gsl_vector_const_view bv = gsl_vector_const_view_array(b.data(), n);
+            gsl_vector_view xv = gsl_vector_view_array(x.data(), n);
+            gsl_linalg_LU_solve(_coarseLU, _coarsePerm, &bv.vector, &xv.vector);
+        }
+        else
+            for (int s = 0; s < _coarseSweeps; s++)
+                gaussSeidel(lev.A, lev.rdiag, b, x, s % 2 == 0);
+        return;
+    }
+
+    for (int s = 0; s < _smoothSteps; s++)
+        gaussSeidel(lev.A, lev.rdiag, b, x, true);
+
+    // Restrict the residual by summing over each aggregate, and correct by the coarse solution, constant over each aggregate.
+    std::vector<double> r;
+    lev.A.multiply(x, r);
+    const size_t nc = _levels[l + 1].A.size;
+    std::vector<double> bc(nc, 0.0), xc(nc, 0.0);
+    for (size_t i = 0; i < n; i++)
+        bc[lev.aggregate[i]] += b[i] - r[i];
+
+    cycle(l + 1, bc, xc);
+    for (size_t i = 0; i < n; i++)
+        x[i] += xc[lev.aggregate[i]];
+
+    for (int s = 0; s < _smoothSteps; s++)
+        gaussSeidel(lev.A, lev.rdiag, b, x, false);
+}
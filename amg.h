@@ -0,0 +1,65 @@
+#pragma once
+#include "pch.h"
+#include "sparse.h"
+#include "solver.h"
+
+// Settings for building an aggregation based algebraic multigrid hierarchy (see amgPreconditioner).
+struct amgSettings
+{
+	// Sites i and j are strongly coupled if a jump between them is likely from either side:
+	// A(i,j) >= strength |A(j,j)| or A(j,i) >= strength |A(i,i)|. Only strongly coupled sites are aggregated.
+	double strength = 0.1;
+
+	// Levels are added until one has at most coarseSize rows, or coarsening stalls.
+	size_t coarseSize = 500;
+	int maxLevels = 25;
+
+	// A coarsest level of at most this many rows is solved by dense LU, otherwise by coarseSweeps Gauss-Seidel sweeps.
+	size_t maxDense = 2000;
+	int coarseSweeps = 20;
+
+	// Gauss-Seidel sweeps before (forward) and after (backward) each coarse grid correction.
+	int smoothSteps = 1;
+};
+
+// Algebraic multigrid preconditioner for a rate matrix, or the pinned system of one.
+// Each level merges strongly coupled sites into aggregates, i.e. sites between which charge moves quickly
+// compared to its escape from them, and the next level is the Galerkin product R A P with piecewise constant P and R = P^T.
+// The columns of a rate matrix sum to zero and its off diagonal elements are positive, and this product keeps both,
+// so every level is again (minus) an M-matrix, on which Gauss-Seidel smoothing converges however disordered the rates.
+// Applying the preconditioner is one V-cycle from a zero initial guess.
+class amgPreconditioner : public preconditioner
+{
+private:
+	struct level
+	{
+		sparseMatrix A;
+		std::vector<double> rdiag;
+
+		// Aggregate of the next level that each row belongs to. Empty on the coarsest level.
+		std::vector<size_t> aggregate;
+	};
+
+	std::vector<level> _levels;
+	int _coarseSweeps;
+	int _smoothSteps;
+
+	// Dense LU factorisation of the coarsest level, if it is small enough.
+	gsl_matrix* _coarseLU = NULL;
+	gsl_permutation* _coarsePerm = NULL;
+
+	void cycle(size_t l, const std::vector<double>& b, std::vector<double>& x) const;
+
+public:
+	amgPreconditioner(const sparseMatrix& A, const amgSettings& settings = amgSettings());
+	~amgPreconditioner();
+	amgPreconditioner(const amgPreconditioner&) = delete;
+	amgPreconditioner& operator=(const amgPreconditioner&) = delete;
+
+	void apply(const std::vector<double>& r, std::vector<double>& z) const;
+
+	size_t NumLevels() const { return _levels.size(); }
+
+	// Stored elements of all levels relative to those of the finest.
+	double OperatorComplexity() const;
+};
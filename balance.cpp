@@ -0,0 +1,106 @@
+#include "pch.h"
+#include "balance.h"
+
+namespace
+{
+    // pi^1/2 relative to its largest element, which can't overflow however large the energy differences.
+    std::vector<double> sqrtOccupations(const std::vector<double>& logPi)
+    {
+        double largest = -std::numeric_limits<double>::infinity();
+        for (size_t i = 0; i < logPi.size(); i++)
+            largest = std::max(largest, logPi[i]);
+
+        std::vector<double> scale(logPi.size());
+        for (size_t i = 0; i < logPi.size(); i++)
+            scale[i] = std::exp(0.5 * (logPi[i] - largest));
+        return scale;
+    }
+
+    // The pinned system B x = b of A (see PinnedSystem) transformed to C y = c, with C = -S^-1 B S and c = -S^-1 b
+    // in every row but the pinned one r, and y = S^-1 x, where S = diag(scale). With scale = pi^1/2 and A satisfying
+    // detailed balance, C is symmetric positive definite: B restricted to the other sites is minus a rate matrix
+    // with at least one escape (to r), so has negative eigenvalues, and row and column r are those of the identity.
+    void symmetricPinnedSystem(const sparseMatrix& A, const std::vector<double>& scale, size_t r, sparseMatrix& C, std::vector<double>& c)
+    {
+        PinnedSystem(A, r, C, c);
+        for (size_t i = 0; i < C.size; i++)
+        {
+            double sign = (i == r) ? 1.0 : -1.0;
+            for (size_t k = C.rowStart[i]; k < C.rowStart[i + 1]; k++)
+                C.val[k] *= sign * scale[C.col[k]] / scale[i];
+            c[i] *= sign / scale[i];
+        }
+    }
+}
+
+double DetailedBalanceError(const sparseMatrix& A, const std::vector<double>& logPi)
+{
+    double largest = 0.0;
+    for (size_t i = 0; i < A.size; i++)
+        for (size_t k = A.rowStart[i]; k < A.rowStart[i + 1]; k++)
+        {
+            size_t j = A.col[k];
+            if (j <= i) continue;
+
+            // Compare A(i,j) (pi_j / pi_i)^1/2 with A(j,i) (pi_i / pi_j)^1/2, which only involves the ratio of neighbouring pi.
+            double half = 0.5 * (logPi[j] - logPi[i]);
+            double forward = A.val[k] * std::exp(half);
+            double backward = A.get(j, i) * std::exp(-half);
+            if (!std::isfinite(forward) || !std::isfinite(backward))
+                return std::numeric_limits<double>::infinity();
+            double size = std::max(std::abs(forward), std::abs(backward));
+            if (size > 0.0)
+                largest = std::max(largest, std::abs(forward - backward) / size);
+        }
+
+    return largest;
+}
+
+solveInfo SymmetricSteadyState(const sparseMatrix& A, const std::vector<double>& logPi, std::vector<double>& P, double tol, int maxIter)
+{
+    size_t r = PinnedSite(A);
+    std::vector<double> scale = sqrtOccupations(logPi);
+    sparseMatrix C;
+    std::vector<double> c;
+    symmetricPinnedSystem(A, scale, r, C, c);
+
+    // Equilibrium occupations x = pi / pi_r, so y = S^-1 x = pi^1/2 / pi_r.
+    std::vector<double> y(A.size);
+    for (size_t i = 0; i < A.size; i++)
+        y[i] = scale[i] / (scale[r] * scale[r]);
+
+    jacobiPreconditioner jacobi(C);
+    solveInfo info = CG(C, c, y, jacobi, tol, maxIter);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < A.size; i++)
+        sum += scale[i] * y[i];
+    P.resize(A.size);
+    for (size_t i = 0; i < A.size; i++)
+        P[i] = scale[i] * y[i] / sum;
+
+    return info;
+}
+
+detailedBalancePreconditioner::detailedBalancePreconditioner(const sparseMatrix& A0, const std::vector<double>& logPi0, const luSymbolic& symbolic) :
+    _pinned(PinnedSite(A0)),
+    _scale(sqrtOccupations(logPi0)),
+    _ldl(symbolic)
+{
+    sparseMatrix C;
+    std::vector<double> c;
+    symmetricPinnedSystem(A0, _scale, _pinned, C, c);
+    _factored = _ldl.factor(C);
+}
+
+void detailedBalancePreconditioner::apply(const std::vector<double>& r, std::vector<double>& z) const
+{
+    // B0 z = r is C0 (S^-1 z) = -S^-1 r, except in the pinned row.
+    std::vector<double> w(r.size());
+    for (size_t i = 0; i < r.size(); i++)
+        w[i] = ((i == _pinned) ? 1.0 : -1.0) * r[i] / _scale[i];
+
+    _ldl.solve(w, z);
+    for (size_t i = 0; i < z.size(); i++)
+        z[i] *= _scale[i];
+}
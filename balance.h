@@ -0,0 +1,53 @@
+#pragma once
+#include "pch.h"
+#include "sparse.h"
+#include "solver.h"
+#include "direct.h"
+
+// Largest violation of detailed balance (see DetailedBalanceError) for a rate matrix to be treated as satisfying it.
+const double detailedBalanceTol = 1e-10;
+
+// A rate matrix A (A(i,j) the rate from j into i) satisfies detailed balance with respect to the equilibrium occupation
+// probabilities pi = exp(logPi) if A(i,j) pi_j = A(j,i) pi_i for every pair of sites, i.e. there is no net flux between any pair.
+// Returns the largest relative difference between the two sides over all pairs, which is zero (to rounding) if it holds,
+// or infinity if either side of any pair isn't finite (e.g. overflows).
+double DetailedBalanceError(const sparseMatrix& A, const std::vector<double>& logPi);
+
+// Find the steady state P of a rate matrix A which satisfies detailed balance with respect to exp(logPi).
+// The pinned system is made symmetric positive definite by the diagonal similarity pi^-1/2 (...) pi^1/2 and solved by CG.
+// It starts from the equilibrium occupations, which solve it exactly if detailed balance holds exactly,
+// so CG only has to correct for any violation within detailedBalanceTol.
+solveInfo SymmetricSteadyState(const sparseMatrix& A, const std::vector<double>& logPi, std::vector<double>& P, double tol, int maxIter);
+
+// How the rate matrix at zero field preconditions solves at small fields (see detailedBalancePreconditioner).
+// exact applies its exact inverse, by sparse LDL^T with nested dissection: fewest iterations, but with a lot of fill in three dimensions.
+// incomplete uses an IC(0) factorisation with no fill, which is cheap to apply.
+enum class BalanceForm { off, exact, incomplete };
+
+// Preconditioner for the pinned system of a rate matrix close to detailed balance, e.g. at a small field.
+// Applies the inverse of the pinned system of a reference rate matrix A0 which satisfies detailed balance,
+// e.g. the rate matrix at zero field, by symmetrising it and factorising as L D L^T.
+// The symmetrised system is a symmetric M-matrix, so an incomplete factorisation (from an incomplete luSymbolic) also exists.
+// Use with SteadyState, pinned at Pinned().
+class detailedBalancePreconditioner : public preconditioner
+{
+private:
+	size_t _pinned;
+
+	// pi^1/2, relative to its largest element.
+	std::vector<double> _scale;
+
+	sparseLDL _ldl;
+	bool _factored;
+
+public:
+	// A0 must satisfy detailed balance with respect to exp(logPi0), and symbolic must have been analysed for its pattern.
+	detailedBalancePreconditioner(const sparseMatrix& A0, const std::vector<double>& logPi0, const luSymbolic& symbolic);
+
+	size_t Pinned() const { return _pinned; }
+
+	// False if the pinned system of A0 is singular (e.g. A0 is disconnected), in which case the preconditioner can't be applied.
+	bool Factored() const { return _factored; }
+
+	void apply(const std::vector<double>& r, std::vector<double>& z) const;
+};
@@ -0,0 +1,362 @@
+// Scaling benchmark: time each stage of a steady state calculation on synthetic disordered cubic lattices of increasing size,
+// so that a performance regression in any of them shows up. For each size the lattice is written as .xyz and .edge files,
+// then read back and solved exactly as by MESolver.
+// The vectorised rate kernel is checked against the scalar formula on every lattice. On every lattice small enough for the SVD,
+// the sparse LU solver is checked against it, and solverContext's reuse between solves against a new context.
+// The benchmark stops with an error if any of them disagrees.
+
+
+#include "pch.h"
+#include "consts.h"
+#include "site.h"
+#include "graph.h"
+#include "transporter.h"
+#include "solver.h"
+#include "direct.h"
+#include "context.h"
+#include "parallel.h"
+#include "lattice.h"
+#include "marcus.h"
+#include "profile.h"
+#include <chrono>
+
+
+namespace
+{
+    // Options
+    std::vector<size_t> sizes = { 100, 1000, 10000, 100000, 1000000 };
+    double sigma = 0.1; // eV
+    double fieldZ = 0.001; // V/Ang
+    double temp = 300.0; // K
+    double reorg = 0.2; // eV
+    transporter::PrecondForm form = transporter::PrecondForm::boltzmann;
+    SolverForm solver = SolverForm::bicgstab;
+    KrylovPrecond krylovPrecond = KrylovPrecond::amg;
+    double solverTol = 1e-10;
+    int maxIter = 10000;
+    size_t denseMax = 1000;
+    std::filesystem::path dir;
+    bool keep = false;
+    std::string csv;
+
+    // Largest relative difference between two steady states of the same system (occupations relative to the largest,
+    // and velocity) found by different routes before one is treated as wrong.
+    const double steadyStateCheckTol = 1e-6;
+
+    struct stageResult
+    {
+        size_t sites;
+        std::string stage;
+        double seconds;
+        double peakMB;
+    };
+    std::vector<stageResult> results;
+
+    // Run one stage, recording its wall time and the peak RSS once it is done.
+    template<typename F>
+    void stage(size_t sites, const std::string& name, const F& f)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        results.push_back({ sites, name, seconds, PeakRSS() });
+
+        const stageResult& r = results.back();
+        std::cout << std::setw(10) << std::left << r.sites
+            << std::setw(26) << std::left << r.stage
+            << std::setw(14) << std::left << r.seconds
+            << std::setw(14) << std::left << (r.seconds > 0.0 ? r.sites / r.seconds : 0.0)
+            << r.peakMB << std::endl;
+    }
+
+    // Compare steady state P and its velocity v with reference and its velocity vRef, by the largest difference in occupation
+    // relative to the largest occupation, and the relative difference in velocity. Stops with an error beyond steadyStateCheckTol.
+    void compareSteadyStates(const std::string& name, const std::vector<double>& reference, const std::vector<double>& P, double vRef, double v)
+    {
+        double largest = 0.0, diff = 0.0;
+        for (size_t j = 0; j < P.size(); j++)
+        {
+            largest = std::max(largest, std::abs(reference[j]));
+            diff = std::max(diff, std::abs(P[j] - reference[j]));
+        }
+        double occupation = diff / largest;
+        double velocity = std::abs(v - vRef) / std::max(std::abs(vRef), std::numeric_limits<double>::min());
+
+        std::cout << "    " << name << ": max occupation difference " << occupation << ", velocity_z difference " << velocity << "\n";
+        if (!(occupation <= steadyStateCheckTol && velocity <= steadyStateCheckTol))
+        {
+            std::cout << "***ERROR***: " << name << ": steady states differ by more than " << steadyStateCheckTol << ".\n";
+            exit(-1);
+        }
+    }
+
+    // Stop with an error if a solverContext call failed.
+    void checkStatus(meStatus status, const solverContext& context)
+    {
+        if (status != meStatus::ok)
+        {
+            std::cout << "***ERROR***: solverContext: " << StatusString(status) << ": " << context.LastError() << "\n";
+            exit(-1);
+        }
+    }
+
+    // Solve through solverContext at fieldZ and then twice fieldZ, the second solve reusing the context's rate matrix, symbolic
+    // factorisation and last solution, and compare it with the solve of a new context at twice fieldZ.
+    void checkContext(const std::vector<site>& sites, const siteGraph& graph, const periodicBox& box, SolverForm contextSolver)
+    {
+        std::vector<interaction> interactions;
+        for (size_t e = 0; e < graph.numEdges(); e++)
+            if (graph.origin[e] < graph.dest[e])
+                interactions.push_back({ graph.origin[e], graph.dest[e], graph.J[e] });
+
+        meParameters par;
+        par.temp = temp;
+        par.reorg = reorg;
+        par.fieldZ = fieldZ;
+        par.form = form;
+        par.solver = contextSolver;
+        par.precond = krylovPrecond;
+        par.tol = solverTol;
+        par.maxIter = maxIter;
+
+        solverContext reused, fresh;
+        meResult first, second, reference;
+        checkStatus(reused.SetSystem(sites, interactions, box), reused);
+        checkStatus(reused.Solve(par, first), reused);
+        par.fieldZ = 2.0 * fieldZ;
+        checkStatus(reused.Solve(par, second), reused);
+        checkStatus(fresh.SetSystem(sites, interactions, box), fresh);
+        checkStatus(fresh.Solve(par, reference), fresh);
+
+        compareSteadyStates(std::string("solverContext (") + (contextSolver == SolverForm::direct ? "direct" : "iterative") + "), reused vs new at twice the field",
+            reference.occupation, second.occupation, reference.velocityZ, second.velocityZ);
+    }
+
+    void run(size_t target)
+    {
+        latticeSettings lattice = CubicLattice(target, sigma);
+        const size_t M = LatticeSites(lattice);
+        const std::string name = "lattice_" + std::to_string(M);
+        std::string xyz = (dir / (name + ".xyz")).string();
+        std::string edge = (dir / (name + ".edge")).string();
+        std::string sim = keep ? (dir / (name + ".sim")).string() : "";
+
+        ResetPeakRSS();
+        stage(M, "generate", [&]() { WriteLattice(lattice, xyz, edge, sim, fieldZ, temp, reorg); });
+
+        siteGraph graph;
+        std::vector<site> sites;
+        stage(M, "CreateSites", [&]() { sites = CreateSites(&xyz[0], &edge[0], graph); });
+        periodicBox box;
+        if (LatticePeriodicZ(lattice)) box.Z = LatticeSizeZ(lattice);
+        stage(M, "SetGeometry", [&]() { graph.SetGeometry(sites, box); });
+
+        std::unique_ptr<transporter> transport;
+        stage(M, "rates", [&]() { transport.reset(new transporter(sites, graph, kB * temp, fieldZ, reorg, 0.0)); });
+
+        double rateDeviation = transport->CheckRates();
+        std::cout << "    " << MarcusRatesISA() << " rate kernel, max relative deviation from scalar formula " << rateDeviation << "\n";
+        if (!(rateDeviation <= marcusRatesTol))
+        {
+            std::cout << "***ERROR***: Rate kernel deviates from the scalar formula by more than " << marcusRatesTol << ".\n";
+            exit(-1);
+        }
+
+        sparseMatrix A;
+        stage(M, "CreateSparseRateMatrix", [&]() { A = transport->CreateSparseRateMatrix(form, false, false); });
+
+        // The dense matrix and its SVD, as used by MESolver's default solver, are O(M^2) in memory and O(M^3) in time.
+        if (M <= denseMax)
+        {
+            gsl_matrix* dense = NULL;
+            stage(M, "CreateRateMatrix", [&]() { dense = transport->CreateRateMatrix(form, false, false); });
+
+            gsl_matrix* V = gsl_matrix_alloc(M, M);
+            gsl_vector* S = gsl_vector_alloc(M);
+            gsl_vector* work = gsl_vector_alloc(M);
+            stage(M, "SVD", [&]() { gsl_linalg_SV_decomp(dense, V, S, work); });
+
+            // The steady state is the right singular vector of the smallest singular value, the last, turned into probabilities
+            // exactly as MESolver's SVD path does.
+            std::vector<double> Psvd(M);
+            for (size_t j = 0; j < M; j++)
+                Psvd[j] = gsl_matrix_get(V, j, M - 1);
+            transport->RemovePreconditioning(Psvd, form);
+            NormaliseSteadyState(Psvd);
+            gsl_matrix_free(dense);
+            gsl_matrix_free(V);
+            gsl_vector_free(S);
+            gsl_vector_free(work);
+
+            // Check the sparse LU solver against it, then check that a second solve reusing the symbolic factorisation
+            // (as in a sweep) at another field matches one with its own.
+            std::unique_ptr<luSymbolic> symbolic;
+            std::vector<double> Pdirect;
+            stage(M, "DirectSteadyState", [&]()
+            {
+                symbolic.reset(new luSymbolic(A));
+                DirectSteadyState(A, Pdirect, *symbolic, solverTol);
+            });
+            transport->RemovePreconditioning(Pdirect, form);
+            compareSteadyStates("direct vs SVD", Psvd, Pdirect, transport->velocity_z(Psvd), transport->velocity_z(Pdirect));
+
+            transport->SetFieldZ(2.0 * fieldZ);
+            transport->UpdateSparseRateMatrix(A, form);
+            std::vector<double> Preused, Pfresh;
+            DirectSteadyState(A, Preused, *symbolic, solverTol);
+            DirectSteadyState(A, Pfresh, luSymbolic(A), solverTol);
+            transport->RemovePreconditioning(Preused, form);
+            transport->RemovePreconditioning(Pfresh, form);
+            compareSteadyStates("direct, reused vs new factorisation at twice the field", Pfresh, Preused, transport->velocity_z(Pfresh), transport->velocity_z(Preused));
+
+            transport->SetFieldZ(fieldZ);
+            transport->UpdateSparseRateMatrix(A, form);
+
+            checkContext(sites, graph, box, solver == SolverForm::direct ? SolverForm::bicgstab : solver);
+            checkContext(sites, graph, box, SolverForm::direct);
+        }
+
+        std::vector<double> P;
+        solveInfo info;
+        stage(M, "SteadyState", [&]() { info = SteadyState(A, P, solver, solverTol, maxIter, krylovPrecond); });
+        transport->RemovePreconditioning(P, form);
+
+        double v = 0.0;
+        stage(M, "velocity_z", [&]() { v = transport->velocity_z(P); });
+
+        std::cout << "    " << LatticePairs(lattice) << " pairs, " << A.nnz() << " non-zero elements, "
+            << info.iterations << " iterations, relative residual " << info.residual << ", velocity_z (Ang/s) " << v << "\n";
+        if (!info.converged)
+            std::cout << "***WARNING***: Solver did not converge to the requested tolerance.\n";
+
+        if (!keep)
+        {
+            std::filesystem::remove(xyz);
+            std::filesystem::remove(edge);
+        }
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    //Parse command line parameters.
+    for (int i = 1; i < argc; i++) {
+        if (strstr(argv[i], "--sizes="))
+        {
+            // Comma separated numbers of sites, each rounded to the nearest cube.
+            sizes.clear();
+            char* substr = strchr(argv[i], '=');
+            ++substr;
+            char* next_token;
+            for (char* token = strtok_s(substr, ",", &next_token); token; token = strtok_s(NULL, ",", &next_token))
+            {
+                double n = atof(token);
+                if (n >= 1.0) sizes.push_back((size_t)n);
+            }
+        }
+        if (strstr(argv[i], "--sigma="))
+        {
+            char* substr = strchr(argv[i], '=');
+            sigma = atof(++substr);
+        }
+        if (strstr(argv[i], "--fieldZ="))
+        {
+            char* substr = strchr(argv[i], '=');
+            fieldZ = atof(++substr);
+        }
+        if (strstr(argv[i], "--temp="))
+        {
+            char* substr = strchr(argv[i], '=');
+            temp = atof(++substr);
+        }
+        if (strstr(argv[i], "--precondition="))
+        {
+            char* substr = strchr(argv[i], '=');
+            ++substr;
+            if (strcmp(substr, "off") == 0) form = transporter::PrecondForm::off;
+            else if (strcmp(substr, "boltzmann") == 0) form = transporter::PrecondForm::boltzmann;
+            else if (strcmp(substr, "boltzmannSquared") == 0) form = transporter::PrecondForm::boltzmannSquared;
+            else if (strcmp(substr, "rateSum") == 0) form = transporter::PrecondForm::rateSum;
+        }
+        if (strstr(argv[i], "--solver="))
+        {
+            char* substr = strchr(argv[i], '=');
+            ++substr;
+            if (strcmp(substr, "bicgstab") == 0) solver = SolverForm::bicgstab;
+            else if (strcmp(substr, "gmres") == 0) solver = SolverForm::gmres;
+            else if (strcmp(substr, "direct") == 0) solver = SolverForm::direct;
+            else
+            {
+                std::cout << "***ERROR***: Unknown solver " << substr << ". Expected bicgstab, gmres or direct.\n";
+                exit(-1);
+            }
+        }
+        if (strcmp(argv[i], "--jacobi") == 0) krylovPrecond = KrylovPrecond::jacobi;
+        if (strstr(argv[i], "--solverTol="))
+        {
+            char* substr = strchr(argv[i], '=');
+            solverTol = atof(++substr);
+        }
+        if (strstr(argv[i], "--maxIter="))
+        {
+            char* substr = strchr(argv[i], '=');
+            maxIter = atoi(++substr);
+        }
+        if (strstr(argv[i], "--denseMax="))
+        {
+            char* substr = strchr(argv[i], '=');
+            denseMax = (size_t)atof(++substr);
+        }
+        if (strstr(argv[i], "--threads="))
+        {
+            char* substr = strchr(argv[i], '=');
+            SetNumThreads(atoi(++substr));
+        }
+        if (strstr(argv[i], "--dir="))
+        {
+            char* substr = strchr(argv[i], '=');
+            dir = ++substr;
+        }
+        if (strcmp(argv[i], "--keep") == 0) keep = true;
+        if (strstr(argv[i], "--csv="))
+        {
+            char* substr = strchr(argv[i], '=');
+            csv = ++substr;
+        }
+    }
+    if (dir.empty())
+        dir = std::filesystem::temp_directory_path() / "mesolver_benchmark";
+    std::filesystem::create_directories(dir);
+    std::sort(sizes.begin(), sizes.end());
+
+    std::cout << "Lattices with sigma (eV) = " << sigma << ", written to " << dir.string() << (keep ? " (kept)" : "") << "\n";
+    std::cout << "fieldZ (V/Ang) = " << fieldZ << ", temp (K) = " << temp << ", reorg (eV) = " << reorg << "\n";
+    std::cout << "Solver " << (solver == SolverForm::direct ? "direct" : solver == SolverForm::gmres ? "gmres" : "bicgstab");
+    if (solver != SolverForm::direct)
+        std::cout << ", " << (krylovPrecond == KrylovPrecond::amg ? "AMG" : "Jacobi") << " preconditioner";
+    std::cout << ", " << NumThreads() << " threads\n";
+    std::cout << "Dense rate matrix and SVD up to " << denseMax << " sites\n\n";
+
+    std::cout << std::setw(10) << std::left << "sites"
+        << std::setw(26) << std::left << "stage"
+        << std::setw(14) << std::left << "time (s)"
+        << std::setw(14) << std::left << "sites/s"
+        << "peak RSS (MB)\n";
+    for (size_t s = 0; s < sizes.size(); s++)
+        run(sizes[s]);
+
+    if (!csv.empty())
+    {
+        std::ofstream out(csv);
+        if (!out) {
+            std::cout << "***ERROR***: Unable to create " << csv << std::endl;
+            exit(-1);
+        }
+        out << "sites,stage,seconds,sites_per_second,peak_rss_mb\n";
+        for (size_t r = 0; r < results.size(); r++)
+            out << results[r].sites << "," << results[r].stage << "," << results[r].seconds << ","
+                << (results[r].seconds > 0.0 ? results[r].sites / results[r].seconds : 0.0) << "," << results[r].peakMB << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include "pch.h"
+#include "context.h"
+#include "consts.h"
+
+const char* StatusString(meStatus status)
+{
+    switch (status)
+    {
+    case meStatus::ok: return "ok";
+    case meStatus::noSystem: return "no system set";
+    case meStatus::invalidSystem: return "invalid system";
+    case meStatus::invalidParameters: return "invalid parameters";
+    case meStatus::notConverged: return "solver did not converge";
+    case meStatus::singular: return "singular rate matrix";
+    case meStatus::failed: return "solver failed";
+    }
+    return "";
+}
+
+meStatus solverContext::fail(meStatus status, const std::string& message)
+{
+    _error = message;
+    return status;
+}
+
+void solverContext::clear()
+{
+    // The transporter refers to the sites and graph, so goes first.
+    _transport.reset();
+    _symbolic.reset();
+    _A = sparseMatrix();
+    _P.clear();
+    _formP = transporter::PrecondForm::off;
+}
+
+meStatus solverContext::SetSystem(size_t numSites, const double* xyz, const double* energy, size_t numPairs, const size_t* pairs, const double* J,
+    const periodicBox& box)
+{
+    if (numSites == 0 || !xyz || !energy || (numPairs > 0 && (!pairs || !J)))
+        return fail(meStatus::invalidSystem, "No sites, or a missing array");
+
+    std::vector<site> sites(numSites);
+    for (size_t s = 0; s < numSites; s++)
+        sites[s] = site(xyz[3 * s], xyz[3 * s + 1], xyz[3 * s + 2], energy[s]);
+
+    std::vector<interaction> interactions(numPairs);
+    for (size_t k = 0; k < numPairs; k++)
+        interactions[k] = { pairs[2 * k], pairs[2 * k + 1], J[k] };
+
+    return SetSystem(sites, interactions, box);
+}
+
+meStatus solverContext::SetSystem(const std::vector<site>& sites, const std::vector<interaction>& interactions, const periodicBox& box)
+{
+    clear();
+    _sites.clear();
+    _graph = siteGraph();
+
+    const size_t M = sites.size();
+    if (M == 0)
+        return fail(meStatus::invalidSystem, "No sites");
+    for (size_t s = 0; s < M; s++)
+        if (!std::isfinite(sites[s].pos.X) || !std::isfinite(sites[s].pos.Y) || !std::isfinite(sites[s].pos.Z) || !std::isfinite(sites[s].energy))
+            return fail(meStatus::invalidSystem, "Site " + std::to_string(s) + " has a position or energy that isn't finite");
+    for (size_t k = 0; k < interactions.size(); k++)
+    {
+        if (interactions[k].s1 >= M || interactions[k].s2 >= M)
+            return fail(meStatus::invalidSystem, "Pair " + std::to_string(k) + " refers to a site beyond the " + std::to_string(M) + " given");
+        if (!std::isfinite(interactions[k].J))
+            return fail(meStatus::invalidSystem, "Pair " + std::to_string(k) + " has a transfer integral that isn't finite");
+    }
+    if (!(box.X >= 0.0 && box.Y >= 0.0 && box.Z >= 0.0) || !std::isfinite(box.X) || !std::isfinite(box.Y) || !std::isfinite(box.Z))
+        return fail(meStatus::invalidSystem, "Periodic box sizes must be finite, and positive or zero for no boundary");
+
+    try
+    {
+        _sites = sites;
+        _graph = siteGraph(M, interactions);
+        _graph.SetGeometry(_sites, box);
+    }
+    catch (const std::exception& e)
+    {
+        _sites.clear();
+        _graph = siteGraph();
+        return fail(meStatus::failed, e.what());
+    }
+
+    _error.clear();
+    return meStatus::ok;
+}
+
+meStatus solverContext::Solve(const meParameters& par, meResult& result)
+{
+    if (_sites.empty())
+        return fail(meStatus::noSystem, "Solve called before SetSystem");
+    if (!(par.temp > 0.0) || !std::isfinite(par.temp) || !(par.reorg > 0.0) || !std::isfinite(par.reorg))
+        return fail(meStatus::invalidParameters, "Temperature and reorganisation energy must be positive");
+    if (!std::isfinite(par.fieldX) || !std::isfinite(par.fieldY) || !std::isfinite(par.fieldZ) || !std::isfinite(par.transE))
+        return fail(meStatus::invalidParameters, "Field and transport energy must be finite");
+    if (par.solver != SolverForm::bicgstab && par.solver != SolverForm::gmres && par.solver != SolverForm::direct)
+        return fail(meStatus::invalidParameters, "Only the sparse solvers (bicgstab, gmres and direct) are available");
+    // Checked here, as an unknown value (easily passed from C or through a foreign function interface) would otherwise
+    // throw inside a parallel loop, where it can't be caught.
+    if (par.form != transporter::PrecondForm::off && par.form != transporter::PrecondForm::boltzmann
+        && par.form != transporter::PrecondForm::boltzmannSquared && par.form != transporter::PrecondForm::rateSum)
+        return fail(meStatus::invalidParameters, "Unknown preconditioning form " + std::to_string((int)par.form));
+    if (par.precond != KrylovPrecond::jacobi && par.precond != KrylovPrecond::amg)
+        return fail(meStatus::invalidParameters, "Unknown Krylov preconditioner " + std::to_string((int)par.precond));
+    if (!(par.tol > 0.0) || par.maxIter <= 0 || par.refine < 0)
+        return fail(meStatus::invalidParameters, "Tolerance and iteration limit must be positive, and refinement steps not negative");
+
+    try
+    {
+        // The rates only need re-evaluating for a new field, unless a constant of the transporter changes.
+        if (!_transport || par.temp != _temp || par.reorg != _reorg || par.transE != _transE || par.logDomain != _logDomain)
+        {
+            _transport.reset(new transporter(_sites, _graph, kB * par.temp, par.fieldX, par.fieldY, par.fieldZ, par.reorg, par.transE, par.logDomain));
+            _temp = par.temp;
+            _reorg = par.reorg;
+            _transE = par.transE;
+            _logDomain = par.logDomain;
+        }
+        else
+            _transport->SetField(par.fieldX, par.fieldY, par.fieldZ);
+
+        // The pattern of the rate matrix is that of the graph, so it's built once and then only its values are rewritten.
+        if (_A.size == 0)
+            _A = _transport->CreateSparseRateMatrix(par.form, false, false);
+        else
+            _transport->UpdateSparseRateMatrix(_A, par.form);
+
+        // A solution conditioned by another form is no guide to this one.
+        if (par.form != _formP)
+            _P.clear();
+
+        if (par.solver == SolverForm::direct)
+        {
+            if (!_symbolic)
+                _symbolic.reset(new luSymbolic(_A));
+            result.info = DirectSteadyState(_A, _P, *_symbolic, par.tol, par.refine);
+        }
+        else
+            result.info = SteadyState(_A, _P, par.solver, par.tol, par.maxIter, par.precond, par.refine);
+        _formP = par.form;
+
+        if (!std::isfinite(result.info.residual) && par.solver == SolverForm::direct)
+        {
+            _P.clear();
+            return fail(meStatus::singular, "Zero pivot in the LU factorisation; the system may be disconnected");
+        }
+
+        result.occupation.assign(_P.begin(), _P.end());
+        _transport->RemovePreconditioning(result.occupation, par.form);
+        _transport->Velocity(result.occupation, result.velocityX, result.velocityY, result.velocityZ);
+
+        // Mobility along the field: the velocity projected onto it, over its strength.
+        const double F2 = par.fieldX * par.fieldX + par.fieldY * par.fieldY + par.fieldZ * par.fieldZ;
+        result.mobility = F2 > 0.0 ? 1e-16 * (result.velocityX * par.fieldX + result.velocityY * par.fieldY + result.velocityZ * par.fieldZ) / F2 : 0.0;
+    }
+    catch (const std::exception& e)
+    {
+        _P.clear();
+        return fail(meStatus::failed, e.what());
+    }
+
+    if (!result.info.converged)
+        return fail(meStatus::notConverged, "Relative residual " + std::to_string(result.info.residual) + " after " + std::to_string(result.info.iterations) + " iterations");
+
+    _error.clear();
+    return meStatus::ok;
+}
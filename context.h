@@ -0,0 +1,113 @@
+#pragma once
+#include "pch.h"
+#include "site.h"
+#include "graph.h"
+#include "transporter.h"
+#include "solver.h"
+#include "direct.h"
+
+// Library interface, for finding steady states in-process (e.g. from a kinetic Monte Carlo or morphology generation pipeline)
+// many times over, without files, console output or exits. A solverContext owns the sites and site graph of one system,
+// and the transporter, rate matrix, symbolic factorisation and last solution found for it. These are kept between calls,
+// so solving again at new parameters reuses their storage, and iterative solvers start from the last solution.
+// Errors are returned as a status, with a message from LastError().
+
+// Outcome of a solverContext call.
+enum class meStatus
+{
+	ok = 0,
+	noSystem,          // Solve was called before SetSystem.
+	invalidSystem,     // No sites, a site index out of range, or a position, energy or transfer integral that isn't finite.
+	invalidParameters, // A temperature or reorganisation energy that isn't positive, a field that isn't finite, a dense solver,
+	                   // or an unknown preconditioning form or Krylov preconditioner.
+	notConverged,      // The solver didn't reach the tolerance. The result holds the last iterate.
+	singular,          // The direct solver met a zero pivot, e.g. in a disconnected system with no unique steady state.
+	failed             // Any other error within the solver, described by LastError().
+};
+
+// Short description of a status.
+const char* StatusString(meStatus status);
+
+// The simulation parameters and solver options of one solve.
+struct meParameters
+{
+	double temp = 300.0; // K
+	double reorg = 0.2; // eV
+	double fieldX = 0.0, fieldY = 0.0, fieldZ = 0.001; // V/Ang
+	double transE = 0.0; // eV
+
+	// As the options of MESolver. Only the sparse solvers (bicgstab, gmres and direct) are available.
+	transporter::PrecondForm form = transporter::PrecondForm::boltzmann;
+	SolverForm solver = SolverForm::bicgstab;
+	KrylovPrecond precond = KrylovPrecond::amg;
+	double tol = 1e-10;
+	int maxIter = 10000;
+	int refine = 0;
+	bool logDomain = false;
+};
+
+// The results of one solve.
+struct meResult
+{
+	// Steady state occupation probability of each site, in the order given to SetSystem, summing to 1.
+	std::vector<double> occupation;
+
+	// Average velocity of charges (Ang/s), signed as transporter::velocity_z, and the mobility along the field (cm^2 / V*s), zero at zero field.
+	double velocityX = 0.0, velocityY = 0.0, velocityZ = 0.0;
+	double mobility = 0.0;
+
+	solveInfo info;
+};
+
+class solverContext
+{
+private:
+
+	std::vector<site> _sites;
+	siteGraph _graph;
+
+	// The transporter refers to _sites and _graph, and is rebuilt only when a parameter it holds as a constant changes.
+	std::unique_ptr<transporter> _transport;
+	double _temp = 0.0, _reorg = 0.0, _transE = 0.0;
+	bool _logDomain = false;
+
+	// Rate matrix of the system, built once and then updated in place, and its symbolic factorisation for the direct solver.
+	sparseMatrix _A;
+	std::unique_ptr<luSymbolic> _symbolic;
+
+	// Conditioned solution of the last solve, and the form it was conditioned by, the initial guess of the next solve.
+	std::vector<double> _P;
+	transporter::PrecondForm _formP = transporter::PrecondForm::off;
+
+	std::string _error;
+
+	// Record the message of a failed call and return its status.
+	meStatus fail(meStatus status, const std::string& message);
+
+	// Drop everything derived from the system, before the system changes.
+	void clear();
+
+public:
+
+	solverContext() {}
+	solverContext(const solverContext&) = delete;
+	solverContext& operator=(const solverContext&) = delete;
+
+	// Set the system from arrays: the position xyz[3 s .. 3 s + 2] (Ang) and energy (eV) of each of numSites sites, and numPairs
+	// interacting pairs of sites pairs[2 k], pairs[2 k + 1] (numbered from 0, as in a .edge file) with transfer integral J[k] (eV).
+	// box gives any periodic boundaries.
+	meStatus SetSystem(size_t numSites, const double* xyz, const double* energy, size_t numPairs, const size_t* pairs, const double* J,
+		const periodicBox& box = periodicBox());
+
+	// As above, from sites and interactions (as read by CreateSites).
+	meStatus SetSystem(const std::vector<site>& sites, const std::vector<interaction>& interactions, const periodicBox& box = periodicBox());
+
+	// Find the steady state of the system at parameters. result is filled in (reusing its storage) whenever the status is ok or notConverged.
+	meStatus Solve(const meParameters& parameters, meResult& result);
+
+	// Message describing the last failed call.
+	const std::string& LastError() const { return _error; }
+
+	size_t NumSites() const { return _sites.size(); }
+	size_t NumPairs() const { return _graph.numEdges() / 2; }
+};
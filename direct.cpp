@@ -0,0 +1,436 @@
+#include "pch.h"
+#include "direct.h"
+
+namespace
+{
+    const size_t none = std::numeric_limits<size_t>::max();
+
+    // Breadth first search from root through the rows labelled part, treating A(i,j) != 0 as an edge between i and j.
+    // Fills visit with the rows reached in order and sets their depth, which the caller must reset to none.
+    // Returns the number of levels, and sets lastLevelStart to the position in visit of the first row of the final level.
+    size_t levels(const sparseMatrix& A, size_t root, const std::vector<size_t>& label, size_t part,
+        std::vector<size_t>& depth, std::vector<size_t>& visit, size_t& lastLevelStart)
+    {
+        visit.clear();
+        visit.push_back(root);
+        depth[root] = 0;
+        for (size_t k = 0; k < visit.size(); k++)
+        {
+            size_t s = visit[k];
+            for (size_t e = A.rowStart[s]; e < A.rowStart[s + 1]; e++)
+            {
+                size_t d = A.col[e];
+                if (label[d] == part && depth[d] == none)
+                {
+                    depth[d] = depth[s] + 1;
+                    visit.push_back(d);
+                }
+            }
+        }
+
+        size_t numLevels = depth[visit.back()] + 1;
+        lastLevelStart = visit.size() - 1;
+        while (lastLevelStart > 0 && depth[visit[lastLevelStart - 1]] == numLevels - 1)
+            lastLevelStart--;
+        return numLevels;
+    }
+
+    void resetDepth(std::vector<size_t>& depth, const std::vector<size_t>& visit)
+    {
+        for (size_t k = 0; k < visit.size(); k++)
+            depth[visit[k]] = none;
+    }
+
+    // Nested dissection: split the graph of A by a separator, number the two halves first and the separator last,
+    // and repeat on each half. Rows of a half are never coupled to those of the other, so eliminating them
+    // only fills in within the half and its separator. Separators are taken from the middle level of a
+    // breadth first search from a pseudo-peripheral row, which on a lattice is a plane through it.
+    std::vector<size_t> nestedDissection(const sparseMatrix& A)
+    {
+        const size_t n = A.size;
+        std::vector<size_t> order(n);
+        std::vector<size_t> label(n, 0), depth(n, none), visit;
+        size_t nextLabel = 1;
+
+        // Each pending subgraph is the rows with one label, to be numbered from position first of order.
+        struct subgraph { std::vector<size_t> rows; size_t first; };
+        std::vector<subgraph> pending;
+        pending.push_back({ std::vector<size_t>(n), 0 });
+        for (size_t i = 0; i < n; i++)
+            pending[0].rows[i] = i;
+
+        auto degree = [&](size_t i) { return A.rowStart[i + 1] - A.rowStart[i]; };
+        auto split = [&](std::vector<size_t>& rows, size_t first)
+        {
+            size_t part = nextLabel++;
+            for (size_t k = 0; k < rows.size(); k++)
+                label[rows[k]] = part;
+            pending.push_back({ std::move(rows), first });
+        };
+
+        while (!pending.empty())
+        {
+            subgraph sub = std::move(pending.back());
+            pending.pop_back();
+            const std::vector<size_t>& rows = sub.rows;
+            size_t part = label[rows[0]];
+
+            size_t lastStart, numLevels = 0;
+            if (rows.size() > dissectionLeafSize)
+            {
+                numLevels = levels(A, rows[0], label, part, depth, visit, lastStart);
+                if (visit.size() < rows.size())
+                {
+                    // Disconnected: the component reached and the rest are independent, with no separator.
+                    std::vector<size_t> reached = visit, rest;
+                    for (size_t k = 0; k < rows.size(); k++)
+                        if (depth[rows[k]] == none) rest.push_back(rows[k]);
+                    resetDepth(depth, visit);
+                    size_t restFirst = sub.first + reached.size();
+                    split(reached, sub.first);
+                    split(rest, restFirst);
+                    continue;
+                }
+
+                // Pseudo-peripheral root, as in ReverseCuthillMcKee.
+                size_t root = rows[0];
+                for (size_t k = 0; k < visit.size(); k++)
+                    if (degree(visit[k]) < degree(root)) root = visit[k];
+                resetDepth(depth, visit);
+                numLevels = levels(A, root, label, part, depth, visit, lastStart);
+                while (true)
+                {
+                    size_t candidate = visit[lastStart];
+                    for (size_t k = lastStart; k < visit.size(); k++)
+                        if (degree(visit[k]) < degree(candidate)) candidate = visit[k];
+                    resetDepth(depth, visit);
+                    size_t candidateLevels = levels(A, candidate, label, part, depth, visit, lastStart);
+                    if (candidateLevels <= numLevels)
+                    {
+                        resetDepth(depth, visit);
+                        numLevels = levels(A, root, label, part, depth, visit, lastStart);
+                        break;
+                    }
+                    root = candidate;
+                    numLevels = candidateLevels;
+                }
+            }
+
+            if (numLevels < 3)
+            {
+                // Small, or too densely connected to separate: number in the order given.
+                if (numLevels > 0) resetDepth(depth, visit);
+                for (size_t k = 0; k < rows.size(); k++)
+                {
+                    order[sub.first + k] = rows[k];
+                    label[rows[k]] = none;
+                }
+                continue;
+            }
+
+            // Separate at the level which holds the middle row of the search, keeping at least one level either side.
+            size_t mid = std::min(std::max<size_t>(depth[visit[visit.size() / 2]], 1), numLevels - 2);
+
+            // Only rows of that level coupled to the next are needed in the separator; the rest join the near half.
+            std::vector<size_t> nearHalf, farHalf, separator;
+            for (size_t k = 0; k < visit.size(); k++)
+            {
+                size_t s = visit[k];
+                if (depth[s] < mid)
+                    nearHalf.push_back(s);
+                else if (depth[s] > mid)
+                    farHalf.push_back(s);
+                else
+                {
+                    bool coupled = false;
+                    for (size_t e = A.rowStart[s]; e < A.rowStart[s + 1] && !coupled; e++)
+                        coupled = label[A.col[e]] == part && depth[A.col[e]] == mid + 1;
+                    if (coupled) separator.push_back(s);
+                    else nearHalf.push_back(s);
+                }
+            }
+            resetDepth(depth, visit);
+
+            size_t sepFirst = sub.first + rows.size() - separator.size();
+            for (size_t k = 0; k < separator.size(); k++)
+            {
+                order[sepFirst + k] = separator[k];
+                label[separator[k]] = none;
+            }
+            size_t farFirst = sub.first + nearHalf.size();
+            split(nearHalf, sub.first);
+            split(farHalf, farFirst);
+        }
+
+        return order;
+    }
+}
+
+luSymbolic::luSymbolic(const sparseMatrix& A, bool complete) : size(A.size)
+{
+    const size_t n = size;
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = A.rowStart[i]; k < A.rowStart[i + 1]; k++)
+            if (!std::binary_search(A.col.begin() + A.rowStart[A.col[k]], A.col.begin() + A.rowStart[A.col[k] + 1], i))
+                throw std::logic_error("Sparse LU requires a matrix with a symmetric sparsity pattern.");
+
+    rowStart.resize(n + 1);
+    col.clear();
+    if (!complete)
+    {
+        // No fill: the factors keep the pattern (and order) of A.
+        perm.resize(n);
+        iperm.resize(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            perm[i] = iperm[i] = i;
+            rowStart[i] = col.size();
+            for (size_t k = A.rowStart[i]; k < A.rowStart[i + 1] && A.col[k] < i; k++)
+                col.push_back(A.col[k]);
+        }
+        rowStart[n] = col.size();
+        return;
+    }
+
+    perm = nestedDissection(A);
+    iperm.resize(n);
+    for (size_t i = 0; i < n; i++)
+        iperm[perm[i]] = i;
+
+    // Elimination tree of the permuted matrix (Liu), with path compression through ancestor.
+    std::vector<size_t> parent(n, none), ancestor(n, none);
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = A.rowStart[perm[i]]; k < A.rowStart[perm[i] + 1]; k++)
+        {
+            size_t j = iperm[A.col[k]];
+            while (j != none && j < i)
+            {
+                size_t next = ancestor[j];
+                ancestor[j] = i;
+                if (next == none) parent[j] = i;
+                j = next;
+            }
+        }
+
+    // The pattern of row i of L is the union of the paths up the tree from each j < i with A(i,j) != 0, stopping at i.
+    std::vector<size_t> mark(n, none);
+    for (size_t i = 0; i < n; i++)
+    {
+        rowStart[i] = col.size();
+        mark[i] = i;
+        for (size_t k = A.rowStart[perm[i]]; k < A.rowStart[perm[i] + 1]; k++)
+            for (size_t j = iperm[A.col[k]]; j < i && mark[j] != i; j = parent[j])
+            {
+                col.push_back(j);
+                mark[j] = i;
+            }
+        std::sort(col.begin() + rowStart[i], col.end());
+    }
+    rowStart[n] = col.size();
+}
+
+sparseLU::sparseLU(const luSymbolic& symbolic) : _symbolic(symbolic)
+{
+}
+
+bool sparseLU::factor(const sparseMatrix& B)
+{
+    const luSymbolic& S = _symbolic;
+    const size_t n = S.size;
+    if (B.size != n)
+        throw std::logic_error("Sparse LU factorisation of a matrix of a different size to that analysed.");
+
+    // Pattern of B^T, holding the position in B of each element, to read the columns of B.
+    std::vector<size_t> tStart(n + 1, 0), tRow(B.nnz()), tPos(B.nnz());
+    for (size_t k = 0; k < B.nnz(); k++)
+        tStart[B.col[k] + 1]++;
+    for (size_t i = 0; i < n; i++)
+        tStart[i + 1] += tStart[i];
+    std::vector<size_t> next(tStart.begin(), tStart.end() - 1);
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = B.rowStart[i]; k < B.rowStart[i + 1]; k++)
+        {
+            tRow[next[B.col[k]]] = i;
+            tPos[next[B.col[k]]++] = k;
+        }
+
+    _L.assign(S.col.size(), 0.0);
+    _U.assign(S.col.size(), 0.0);
+    _D.assign(n, 0.0);
+
+    // Row i of L and column i of U follow from the factors of the leading i x i block (bordering):
+    // L11 y = B(0:i, i) and U11^T z = B(i, 0:i), then U(j,i) = y_j / d_j, L(i,j) = z_j / d_j and d_i = B(i,i) - sum z_j y_j / d_j.
+    std::vector<double> y(n, 0.0), z(n, 0.0);
+    std::vector<size_t> mark(n, none);
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t p = S.perm[i];
+        for (size_t k = S.rowStart[i]; k < S.rowStart[i + 1]; k++)
+            mark[S.col[k]] = i;
+
+        double diag = 0.0;
+        for (size_t k = B.rowStart[p]; k < B.rowStart[p + 1]; k++)
+        {
+            size_t j = S.iperm[B.col[k]];
+            if (j == i) diag = B.val[k];
+            else if (j < i)
+            {
+                if (mark[j] != i)
+                    throw std::logic_error("Sparse LU factorisation of a matrix with a pattern outside that analysed.");
+                z[j] = B.val[k];
+            }
+        }
+        for (size_t k = tStart[p]; k < tStart[p + 1]; k++)
+        {
+            size_t j = S.iperm[tRow[k]];
+            if (j < i)
+            {
+                if (mark[j] != i)
+                    throw std::logic_error("Sparse LU factorisation of a matrix with a pattern outside that analysed.");
+                y[j] = B.val[tPos[k]];
+            }
+        }
+
+        double d = diag;
+        for (size_t k = S.rowStart[i]; k < S.rowStart[i + 1]; k++)
+        {
+            size_t j = S.col[k];
+            double yj = y[j], zj = z[j];
+            for (size_t kk = S.rowStart[j]; kk < S.rowStart[j + 1]; kk++)
+            {
+                yj -= _L[kk] * y[S.col[kk]];
+                zj -= _U[kk] * z[S.col[kk]];
+            }
+            y[j] = yj;
+            z[j] = zj;
+            d -= zj * yj / _D[j];
+        }
+        for (size_t k = S.rowStart[i]; k < S.rowStart[i + 1]; k++)
+        {
+            size_t j = S.col[k];
+            _L[k] = z[j] / _D[j];
+            _U[k] = y[j] / _D[j];
+            y[j] = 0.0;
+            z[j] = 0.0;
+        }
+
+        if (!(std::abs(d) > std::numeric_limits<double>::epsilon() * std::abs(diag)))
+            return false;
+        _D[i] = d;
+    }
+
+    return true;
+}
+
+void sparseLU::solve(const std::vector<double>& b, std::vector<double>& x) const
+{
+    const luSymbolic& S = _symbolic;
+    const size_t n = S.size;
+    std::vector<double> w(n);
+    for (size_t i = 0; i < n; i++)
+        w[i] = b[S.perm[i]];
+
+    // L w' = w, by rows
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = S.rowStart[i]; k < S.rowStart[i + 1]; k++)
+            w[i] -= _L[k] * w[S.col[k]];
+
+    for (size_t i = 0; i < n; i++)
+        w[i] /= _D[i];
+
+    // U x' = w', by columns
+    for (size_t i = n; i-- > 0;)
+        for (size_t k = S.rowStart[i]; k < S.rowStart[i + 1]; k++)
+            w[S.col[k]] -= _U[k] * w[i];
+
+    x.resize(n);
+    for (size_t i = 0; i < n; i++)
+        x[S.perm[i]] = w[i];
+}
+
+sparseLDL::sparseLDL(const luSymbolic& symbolic) : _symbolic(symbolic)
+{
+}
+
+bool sparseLDL::factor(const sparseMatrix& C)
+{
+    const luSymbolic& S = _symbolic;
+    const size_t n = S.size;
+    if (C.size != n)
+        throw std::logic_error("Sparse LDL^T factorisation of a matrix of a different size to that analysed.");
+
+    _L.assign(S.col.size(), 0.0);
+    _D.assign(n, 0.0);
+
+    // As sparseLU::factor, where symmetry makes z = y: L11 y = C(0:i, i), then L(i,j) = y_j / d_j and d_i = C(i,i) - sum y_j^2 / d_j.
+    std::vector<double> y(n, 0.0);
+    std::vector<size_t> mark(n, none);
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t p = S.perm[i];
+        for (size_t k = S.rowStart[i]; k < S.rowStart[i + 1]; k++)
+            mark[S.col[k]] = i;
+
+        // Row p of C holds the elements of both the lower and upper triangles of the permuted matrix; take those left of the diagonal.
+        double diag = 0.0;
+        for (size_t k = C.rowStart[p]; k < C.rowStart[p + 1]; k++)
+        {
+            size_t j = S.iperm[C.col[k]];
+            if (j == i) diag = C.val[k];
+            else if (j < i)
+            {
+                if (mark[j] != i)
+                    throw std::logic_error("Sparse LDL^T factorisation of a matrix with a pattern outside that analysed.");
+                y[j] = C.val[k];
+            }
+        }
+
+        double d = diag;
+        for (size_t k = S.rowStart[i]; k < S.rowStart[i + 1]; k++)
+        {
+            size_t j = S.col[k];
+            double yj = y[j];
+            for (size_t kk = S.rowStart[j]; kk < S.rowStart[j + 1]; kk++)
+                yj -= _L[kk] * y[S.col[kk]];
+            y[j] = yj;
+            d -= yj * yj / _D[j];
+        }
+        for (size_t k = S.rowStart[i]; k < S.rowStart[i + 1]; k++)
+        {
+            size_t j = S.col[k];
+            _L[k] = y[j] / _D[j];
+            y[j] = 0.0;
+        }
+
+        if (!(std::abs(d) > std::numeric_limits<double>::epsilon() * std::abs(diag)))
+            return false;
+        _D[i] = d;
+    }
+
+    return true;
+}
+
+void sparseLDL::solve(const std::vector<double>& b, std::vector<double>& x) const
+{
+    const luSymbolic& S = _symbolic;
+    const size_t n = S.size;
+    std::vector<double> w(n);
+    for (size_t i = 0; i < n; i++)
+        w[i] = b[S.perm[i]];
+
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = S.rowStart[i]; k < S.rowStart[i + 1]; k++)
+            w[i] -= _L[k] * w[S.col[k]];
+
+    for (size_t i = 0; i < n; i++)
+        w[i] /= _D[i];
+
+    // L^T, by columns of L^T (rows of L)
+    for (size_t i = n; i-- > 0;)
+        for (size_t k = S.rowStart[i]; k < S.rowStart[i + 1]; k++)
+            w[S.col[k]] -= _L[k] * w[i];
+
+    x.resize(n);
+    for (size_t i = 0; i < n; i++)
+        x[S.perm[i]] = w[i];
+}
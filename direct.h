@@ -0,0 +1,72 @@
+#pragma once
+#include "pch.h"
+#include "sparse.h"
+
+// Sites (rows) in a nested dissection subgraph below which no further separator is sought.
+const size_t dissectionLeafSize = 64;
+
+// Fill-reducing ordering and the structure of the LU (or LDL^T) factors of a matrix with a symmetric sparsity pattern, such as a rate matrix.
+// Depends only on the pattern, so one analysis can be shared by every matrix with that pattern, or a subset of it,
+// e.g. all the points of a sweep, or a pinned system from PinnedSystem.
+struct luSymbolic
+{
+	size_t size = 0;
+
+	// Row i of the permuted matrix is row perm[i] of the original; iperm is the inverse.
+	std::vector<size_t> perm, iperm;
+
+	// Columns (in permuted numbering, ascending) of the strictly lower triangular row i of L,
+	// which are also the rows of the strictly upper triangular column i of U.
+	std::vector<size_t> rowStart;
+	std::vector<size_t> col;
+
+	// Order the rows of A by nested dissection of its graph and find the pattern of the factors.
+	// If not complete, the rows keep their order and the factors the pattern of A, dropping all fill,
+	// for an incomplete factorisation (ILU(0) or IC(0)) to use as a preconditioner.
+	// Throws if the pattern of A is not symmetric.
+	luSymbolic(const sparseMatrix& A, bool complete = true);
+
+	// Number of stored elements of L + D + U.
+	size_t nnzFactors() const { return 2 * col.size() + size; }
+
+	// Number of stored elements of L + D, for an LDL^T factorisation.
+	size_t nnzSymmetricFactors() const { return col.size() + size; }
+};
+
+// Numeric factorisation P B P^T = L D U, with L and U unit triangular, using the pattern found by a luSymbolic.
+// There is no pivoting. That is stable for matrices whose columns are diagonally dominant, which includes
+// rate matrices (whose columns sum to zero) and the pinned systems formed from them, with or without preconditioning.
+class sparseLU
+{
+private:
+	const luSymbolic& _symbolic;
+	std::vector<double> _L, _U, _D;
+
+public:
+	sparseLU(const luSymbolic& symbolic);
+
+	// Factorise B, whose pattern must be within that analysed. Returns false if a pivot is zero, i.e. B is singular.
+	bool factor(const sparseMatrix& B);
+
+	// Solve B x = b with the factors.
+	void solve(const std::vector<double>& b, std::vector<double>& x) const;
+};
+
+// Numeric factorisation P C P^T = L D L^T of a symmetric matrix C, using the pattern found by a luSymbolic.
+// Holds only L and D, half the storage of a sparseLU. There is no pivoting, which is stable for definite matrices.
+class sparseLDL
+{
+private:
+	const luSymbolic& _symbolic;
+	std::vector<double> _L, _D;
+
+public:
+	sparseLDL(const luSymbolic& symbolic);
+
+	// Factorise C, whose pattern must be within that analysed. Only the lower triangle of C is read.
+	// Returns false if a pivot is zero, i.e. C is singular.
+	bool factor(const sparseMatrix& C);
+
+	// Solve C x = b with the factors.
+	void solve(const std::vector<double>& b, std::vector<double>& x) const;
+};
@@ -0,0 +1,319 @@
+#include "pch.h"
+#include "graph.h"
+
+siteGraph::siteGraph(size_t M, const std::vector<interaction>& interactions)
+{
+    // Count the edges leaving each site. Each interaction gives an edge in both directions.
+    std::vector<size_t> count(M + 1, 0);
+    for (size_t k = 0; k < interactions.size(); k++)
+        if (interactions[k].s1 != interactions[k].s2)
+        {
+            count[interactions[k].s1 + 1]++;
+            count[interactions[k].s2 + 1]++;
+        }
+    for (size_t s = 0; s < M; s++)
+        count[s + 1] += count[s];
+
+    // Scatter the edges into place, in the order they were listed.
+    std::vector<std::pair<size_t, double>> scattered(count[M]);
+    std::vector<size_t> next(count.begin(), count.end() - 1);
+    for (size_t k = 0; k < interactions.size(); k++)
+    {
+        const interaction& in = interactions[k];
+        if (in.s1 == in.s2) continue;
+        scattered[next[in.s1]++] = std::make_pair(in.s2, in.J);
+        scattered[next[in.s2]++] = std::make_pair(in.s1, in.J);
+    }
+
+    // Sort each site's edges by destination and drop repeated pairs, keeping the first listed.
+    std::vector<size_t> offsetV(M + 1), originV, destV;
+    std::vector<double> JV;
+    originV.reserve(count[M]);
+    destV.reserve(count[M]);
+    JV.reserve(count[M]);
+    offsetV[0] = 0;
+    for (size_t s = 0; s < M; s++)
+    {
+        std::vector<std::pair<size_t, double>>::iterator first = scattered.begin() + count[s];
+        std::vector<std::pair<size_t, double>>::iterator last = scattered.begin() + count[s + 1];
+        std::stable_sort(first, last, [](const std::pair<size_t, double>& a, const std::pair<size_t, double>& b) { return a.first < b.first; });
+
+        for (std::vector<std::pair<size_t, double>>::iterator it = first; it != last; it++)
+        {
+            if (it != first && it->first == (it - 1)->first)
+                continue;
+            originV.push_back(s);
+            destV.push_back(it->first);
+            JV.push_back(it->second);
+        }
+        offsetV[s + 1] = destV.size();
+    }
+
+    offset.assign(std::move(offsetV));
+    origin.assign(std::move(originV));
+    dest.assign(std::move(destV));
+    J.assign(std::move(JV));
+
+    std::vector<size_t> reverseV(dest.size());
+    for (size_t e = 0; e < dest.size(); e++)
+        reverseV[e] = edge(dest[e], origin[e]);
+    reverse.assign(std::move(reverseV));
+}
+
+size_t siteGraph::edge(size_t orig, size_t d) const
+{
+    // Destinations leaving a site are sorted, so use a binary search.
+    const size_t* first = dest.begin() + offset[orig];
+    const size_t* last = dest.begin() + offset[orig + 1];
+    const size_t* it = std::lower_bound(first, last, d);
+
+    if (it != last && *it == d)
+        return it - dest.begin();
+    else
+        return none;
+}
+
+void siteGraph::SetGeometry(const std::vector<site>& sites, const periodicBox& boundaries)
+{
+    box = boundaries;
+
+    // Apply the minimum image convention along an axis of period size, if it is periodic.
+    auto minimumImage = [](double d, double size) { return (size > 0.0) ? d - size * floor(d * (1.0 / size) + 0.5) : d; };
+
+    size_t E = numEdges();
+    std::vector<double> J2V(E), dE0V(E), deltaXV(E), deltaYV(E), deltaZV(E);
+    for (size_t e = 0; e < E; e++)
+    {
+        const site& orig = sites[origin[e]];
+        const site& dst = sites[dest[e]];
+
+        J2V[e] = J[e] * J[e];
+        dE0V[e] = dst.energy - orig.energy;
+
+        deltaXV[e] = minimumImage(dst.pos.X - orig.pos.X, box.X);
+        deltaYV[e] = minimumImage(dst.pos.Y - orig.pos.Y, box.Y);
+        deltaZV[e] = minimumImage(dst.pos.Z - orig.pos.Z, box.Z);
+    }
+
+    J2.assign(std::move(J2V));
+    dE0.assign(std::move(dE0V));
+    deltaX.assign(std::move(deltaXV));
+    deltaY.assign(std::move(deltaYV));
+    deltaZ.assign(std::move(deltaZV));
+}
+
+size_t ConnectedComponents(const siteGraph& graph, std::vector<size_t>& component)
+{
+    size_t M = graph.numSites();
+
+    // Union-find, with path halving and union by size.
+    std::vector<size_t> parent(M), size(M, 1);
+    for (size_t s = 0; s < M; s++)
+        parent[s] = s;
+    auto find = [&](size_t s)
+    {
+        while (parent[s] != s)
+        {
+            parent[s] = parent[parent[s]];
+            s = parent[s];
+        }
+        return s;
+    };
+
+    for (size_t e = 0; e < graph.numEdges(); e++)
+    {
+        size_t a = find(graph.origin[e]);
+        size_t b = find(graph.dest[e]);
+        if (a == b) continue;
+        if (size[a] < size[b]) std::swap(a, b);
+        parent[b] = a;
+        size[a] += size[b];
+    }
+
+    // Number the components in order of their lowest site.
+    std::vector<size_t> label(M, siteGraph::none);
+    size_t numComponents = 0;
+    component.resize(M);
+    for (size_t s = 0; s < M; s++)
+    {
+        size_t root = find(s);
+        if (label[root] == siteGraph::none)
+            label[root] = numComponents++;
+        component[s] = label[root];
+    }
+
+    return numComponents;
+}
+
+std::vector<subsystem> SplitComponents(const std::vector<site>& sites, const siteGraph& graph, const std::vector<size_t>& component, size_t numComponents)
+{
+    std::vector<subsystem> parts(numComponents);
+
+    // Index of each site within its component.
+    std::vector<size_t> local(sites.size());
+    for (size_t s = 0; s < sites.size(); s++)
+    {
+        subsystem& part = parts[component[s]];
+        local[s] = part.index.size();
+        part.index.push_back(s);
+        part.sites.push_back(sites[s]);
+    }
+
+    // Each interacting pair, once.
+    std::vector<std::vector<interaction>> interactions(numComponents);
+    for (size_t e = 0; e < graph.numEdges(); e++)
+        if (graph.origin[e] < graph.dest[e])
+            interactions[component[graph.origin[e]]].push_back({ local[graph.origin[e]], local[graph.dest[e]], graph.J[e] });
+
+    for (size_t c = 0; c < numComponents; c++)
+    {
+        parts[c].graph = siteGraph(parts[c].sites.size(), interactions[c]);
+        parts[c].graph.SetGeometry(parts[c].sites, graph.box);
+    }
+
+    return parts;
+}
+
+namespace
+{
+    // Fixed size header at the start of a binary graph file.
+    struct binaryGraphHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t numSites;
+        uint64_t numEdges;
+        uint64_t reserved[4];
+    };
+
+    const char binaryGraphMagic[8] = { 'M', 'E', 'S', 'G', 'R', 'A', 'P', 'H' };
+    const uint32_t binaryGraphByteOrder = 0x01020304;
+
+    // The graph arrays are referred to in place, which relies on size_t matching the uint64 stored in the file.
+    static_assert(sizeof(size_t) == sizeof(uint64_t), "Binary graph files require a 64-bit size_t");
+
+    template<typename T>
+    void writeArray(std::ofstream& out, const T* data, size_t n)
+    {
+        out.write((const char*)data, n * sizeof(T));
+    }
+}
+
+bool IsBinaryGraph(const mappedFile& file)
+{
+    return file.size() >= sizeof(binaryGraphHeader) && memcmp(file.data(), binaryGraphMagic, sizeof(binaryGraphMagic)) == 0;
+}
+
+void WriteGraph(const char* filename, const std::vector<site>& sites, const siteGraph& graph)
+{
+    std::ofstream out(filename, std::ios::binary);
+    if (!out) {
+        std::cout << "***ERROR***: Unable to open " << filename << std::endl;
+        exit(-1);
+    }
+
+    binaryGraphHeader header = {};
+    memcpy(header.magic, binaryGraphMagic, sizeof(binaryGraphMagic));
+    header.version = binaryGraphVersion;
+    header.byteOrder = binaryGraphByteOrder;
+    header.numSites = sites.size();
+    header.numEdges = graph.numEdges();
+    out.write((const char*)&header, sizeof(header));
+
+    std::vector<double> pos(3 * sites.size()), energy(sites.size());
+    for (size_t s = 0; s < sites.size(); s++)
+    {
+        pos[3 * s] = sites[s].pos.X;
+        pos[3 * s + 1] = sites[s].pos.Y;
+        pos[3 * s + 2] = sites[s].pos.Z;
+        energy[s] = sites[s].energy;
+    }
+    writeArray(out, pos.data(), pos.size());
+    writeArray(out, energy.data(), energy.size());
+    writeArray(out, graph.offset.data(), graph.offset.size());
+    writeArray(out, graph.origin.data(), graph.origin.size());
+    writeArray(out, graph.dest.data(), graph.dest.size());
+    writeArray(out, graph.J.data(), graph.J.size());
+    writeArray(out, graph.reverse.data(), graph.reverse.size());
+
+    if (!out) {
+        std::cout << "***ERROR***: Failed writing " << filename << std::endl;
+        exit(-1);
+    }
+}
+
+std::vector<site> ReadGraph(std::shared_ptr<mappedFile> file, siteGraph& graph)
+{
+    binaryGraphHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+
+    if (header.byteOrder != binaryGraphByteOrder || header.version != binaryGraphVersion)
+    {
+        std::cout << "***ERROR***: Binary graph file has version " << header.version << " or byte order unsupported by this build (expected version " << binaryGraphVersion << ").\n";
+        exit(-1);
+    }
+
+    auto corrupt = [&](const char* problem)
+    {
+        std::cout << "***ERROR***: Binary graph file is corrupt: " << problem << ".\n";
+        exit(-1);
+    };
+
+    // Every count is at most the number of 8 byte words in the file, which keeps the expected size below from overflowing.
+    const uint64_t M = header.numSites;
+    const uint64_t E = header.numEdges;
+    if (M > file->size() / 8 || E > file->size() / 8)
+        corrupt("site or edge count larger than the file");
+    const size_t expected = sizeof(header) + sizeof(double) * (4 * M + E) + sizeof(uint64_t) * (M + 1 + 3 * E);
+    if (file->size() != expected)
+    {
+        std::cout << "***ERROR***: Binary graph file is truncated or corrupt. Expected " << expected << " bytes, found " << file->size() << ".\n";
+        exit(-1);
+    }
+
+    const char* p = file->data() + sizeof(header);
+    const double* pos = (const double*)p; p += sizeof(double) * 3 * M;
+    const double* energy = (const double*)p; p += sizeof(double) * M;
+
+    std::vector<site> sites;
+    sites.reserve(M);
+    for (size_t s = 0; s < M; s++)
+        sites.push_back(site(pos[3 * s], pos[3 * s + 1], pos[3 * s + 2], energy[s]));
+
+    graph = siteGraph();
+    graph.offset.refer((const size_t*)p, M + 1); p += sizeof(uint64_t) * (M + 1);
+    graph.origin.refer((const size_t*)p, E); p += sizeof(uint64_t) * E;
+    graph.dest.refer((const size_t*)p, E); p += sizeof(uint64_t) * E;
+    graph.J.refer((const double*)p, E); p += sizeof(double) * E;
+    graph.reverse.refer((const size_t*)p, E);
+    graph._source = file;
+
+    // Every kernel indexes by these without checks, so check the file describes a valid graph before anything uses it.
+    if (graph.offset[0] != 0 || graph.offset[M] != E)
+        corrupt("edge offsets don't span the edges");
+    for (size_t s = 0; s < M; s++)
+    {
+        if (graph.offset[s + 1] < graph.offset[s])
+            corrupt("edge offsets not in order");
+        for (size_t e = graph.offset[s]; e < graph.offset[s + 1]; e++)
+        {
+            if (graph.origin[e] != s)
+                corrupt("edge origin doesn't match its offset");
+
+            // edge(), the reverse edges and the rate matrix layout all rely on each site's edges being sorted by destination.
+            if (e > graph.offset[s] && graph.dest[e] <= graph.dest[e - 1])
+                corrupt("edge destinations of a site not in increasing order");
+        }
+    }
+    for (size_t e = 0; e < E; e++)
+    {
+        if (graph.dest[e] >= M || graph.dest[e] == graph.origin[e])
+            corrupt("edge destination out of range");
+        size_t r = graph.reverse[e];
+        if (r >= E || graph.origin[r] != graph.dest[e] || graph.dest[r] != graph.origin[e])
+            corrupt("reverse edge out of range or not the reverse");
+    }
+
+    return sites;
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include "pch.h"
+#include "site.h"
+#include "IO.h"
+
+// A contiguous read-only array which either owns its elements,
+// or refers to elements held elsewhere (such as in a memory mapped file).
+template<typename T>
+class graphArray
+{
+private:
+	std::vector<T> _owned;
+	const T* _data = NULL;
+	size_t _size = 0;
+
+public:
+	graphArray() {}
+	graphArray(std::vector<T>&& v) { assign(std::move(v)); }
+	graphArray(const graphArray& other) { *this = other; }
+	graphArray(graphArray&& other) noexcept { *this = std::move(other); }
+
+	graphArray& operator=(const graphArray& other)
+	{
+		if (other._data == other._owned.data()) assign(std::vector<T>(other._owned));
+		else refer(other._data, other._size);
+		return *this;
+	}
+
+	graphArray& operator=(graphArray&& other) noexcept
+	{
+		bool owned = (other._data == other._owned.data());
+		_owned = std::move(other._owned);
+		_data = owned ? _owned.data() : other._data;
+		_size = other._size;
+		other._data = NULL;
+		other._size = 0;
+		return *this;
+	}
+
+	// Take ownership of the elements of v.
+	void assign(std::vector<T>&& v) { _owned = std::move(v); _data = _owned.data(); _size = _owned.size(); }
+
+	// Refer to n elements starting at p, without copying them. The caller must keep them alive.
+	void refer(const T* p, size_t n) { std::vector<T>().swap(_owned); _data = p; _size = n; }
+
+	const T& operator[](size_t i) const { return _data[i]; }
+	const T* begin() const { return _data; }
+	const T* end() const { return _data + _size; }
+	const T* data() const { return _data; }
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+};
+
+// Periodic boundary conditions: the period of an orthorhombic box along each axis (Ang),
+// or zero (or less) along an axis that isn't periodic.
+struct periodicBox
+{
+	double X = 0.0, Y = 0.0, Z = 0.0;
+
+	bool periodic() const { return X > 0.0 || Y > 0.0 || Z > 0.0; }
+};
+
+// The interactions between all sites, stored contiguously in compressed sparse row form
+// (struct-of-arrays: one array per edge property, indexed by edge).
+// The directed edges leaving site s are [offset[s], offset[s+1]), sorted by destination site.
+// Every interacting pair appears as two edges, one in each direction.
+class siteGraph
+{
+private:
+
+	// Keeps the binary file the arrays were read from (if any) mapped for as long as they refer to it.
+	std::shared_ptr<mappedFile> _source;
+
+	friend std::vector<site> ReadGraph(std::shared_ptr<mappedFile> file, siteGraph& graph);
+
+public:
+
+	// Returned by edge() when two sites don't interact.
+	static const size_t none = (size_t)-1;
+
+	// Offset of the first edge leaving each site, plus one past the final edge.
+	graphArray<size_t> offset;
+
+	// Site each edge leaves from.
+	graphArray<size_t> origin;
+
+	// Site each edge leads to.
+	graphArray<size_t> dest;
+
+	// Transfer integral of each edge.
+	graphArray<double> J;
+
+	// Index of the edge running in the opposite direction, so (dest, orig) can be reached in O(1) from (orig, dest).
+	graphArray<size_t> reverse;
+
+	// Field-independent quantities cached per edge by SetGeometry, from which the rate at any field is quickly evaluated.
+	// |J|^2 of each edge.
+	graphArray<double> J2;
+
+	// Change in site energy along each edge, E_dest - E_orig.
+	graphArray<double> dE0;
+
+	// Displacement along each edge, dest - orig, using the minimum image convention along each periodic axis of box.
+	// Computed once, so nothing that uses them needs to apply the boundary conditions.
+	graphArray<double> deltaX;
+	graphArray<double> deltaY;
+	graphArray<double> deltaZ;
+
+	// Periodic boundary conditions the displacements were found with.
+	periodicBox box;
+
+	// Construct an empty graph.
+	siteGraph() {}
+
+	// Construct the graph of numSites sites from a list of interactions.
+	// Interactions of a site with itself are ignored, and if a pair is listed more than once the first J is kept.
+	siteGraph(size_t numSites, const std::vector<interaction>& interactions);
+
+	size_t numSites() const { return offset.empty() ? 0 : offset.size() - 1; }
+	size_t numEdges() const { return dest.size(); }
+	size_t degree(size_t s) const { return offset[s + 1] - offset[s]; }
+
+	// Find the edge from orig to dest. Returns siteGraph::none if the sites don't interact.
+	size_t edge(size_t orig, size_t dest) const;
+
+	// Compute the cached per-edge quantities J2, dE0 and deltaX, deltaY, deltaZ, with periodic boundary conditions box.
+	void SetGeometry(const std::vector<site>& sites, const periodicBox& box);
+};
+
+// Label the connected components of the graph, found by union-find. component[s] is set to the label of site s,
+// with components numbered from 0 in order of their lowest site. Returns the number of components.
+size_t ConnectedComponents(const siteGraph& graph, std::vector<size_t>& component);
+
+// The sites of one connected component, with the graph of the interactions between them.
+struct subsystem
+{
+	// Index in the full system of each site of the component, in ascending order.
+	std::vector<size_t> index;
+
+	std::vector<site> sites;
+	siteGraph graph;
+};
+
+// Split the system into one subsystem per connected component, each with the same geometry as graph.
+// Sites keep their relative order, so each subsystem's rate matrix is the corresponding block of the full one.
+std::vector<subsystem> SplitComponents(const std::vector<site>& sites, const siteGraph& graph, const std::vector<size_t>& component, size_t numComponents);
+
+// Binary graph files hold the sites and the complete siteGraph, so they can be used without any parsing.
+// Layout (all values little-endian, every section 8 byte aligned):
+//   header: char[8] "MESGRAPH", uint32 version, uint32 0x01020304 (byte order check), uint64 numSites, uint64 numEdges, 32 bytes reserved
+//   double pos[numSites][3], double energy[numSites],
+//   uint64 offset[numSites + 1], uint64 origin[numEdges], uint64 dest[numEdges], double J[numEdges], uint64 reverse[numEdges]
+const uint32_t binaryGraphVersion = 1;
+
+// Check whether a file is a binary graph file.
+bool IsBinaryGraph(const mappedFile& file);
+
+// Write the sites and graph to a binary graph file.
+void WriteGraph(const char* filename, const std::vector<site>& sites, const siteGraph& graph);
+
+// Read the sites and graph from a mapped binary graph file.
+// The graph arrays refer directly to the mapped file rather than being copied. They are checked in one pass (offsets in order
+// and spanning the edges, every index in range, each site's destinations strictly increasing, reverse edges consistent),
+// and a file that fails is reported and exits.
+std::vector<site> ReadGraph(std::shared_ptr<mappedFile> file, siteGraph& graph);
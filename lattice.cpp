@@ -0,0 +1,106 @@
+#include "pch.h"
+#include "lattice.h"
+#include "output.h"
+#include <random>
+
+namespace
+{
+    // Open a file for writing, exiting with an error message if that fails.
+    void create(const std::string& filename, std::ofstream& out)
+    {
+        out.open(filename, std::ios::binary);
+        if (!out) {
+            std::cout << "***ERROR***: Unable to create " << filename << std::endl;
+            exit(-1);
+        }
+    }
+}
+
+latticeSettings CubicLattice(size_t numSites, double sigma)
+{
+    latticeSettings settings;
+    size_t n = (size_t)std::max(1.0, std::round(std::cbrt((double)numSites)));
+    settings.nx = settings.ny = settings.nz = n;
+    settings.sigma = sigma;
+    return settings;
+}
+
+size_t LatticeSites(const latticeSettings& settings)
+{
+    return settings.nx * settings.ny * settings.nz;
+}
+
+size_t LatticePairs(const latticeSettings& settings)
+{
+    const size_t nx = settings.nx, ny = settings.ny, nz = settings.nz;
+    return (nx - 1) * ny * nz + nx * (ny - 1) * nz + nx * ny * (LatticePeriodicZ(settings) ? nz : nz - 1);
+}
+
+bool LatticePeriodicZ(const latticeSettings& settings)
+{
+    return settings.periodicZ && settings.nz >= 3;
+}
+
+double LatticeSizeZ(const latticeSettings& settings)
+{
+    return settings.nz * settings.spacing;
+}
+
+void WriteLattice(const latticeSettings& settings, const std::string& xyzFile, const std::string& edgeFile,
+    const std::string& simFile, double fieldZ, double temp, double reorg)
+{
+    const size_t nx = settings.nx, ny = settings.ny, nz = settings.nz;
+    std::mt19937_64 rng(settings.seed);
+    // (A normal distribution needs a positive width, so zero disorder is handled separately.)
+    std::normal_distribution<double> energy(0.0, settings.sigma > 0.0 ? settings.sigma : 1.0);
+    std::normal_distribution<double> offset(0.0, settings.positional > 0.0 ? settings.positional : 1.0);
+    std::uniform_real_distribution<double> J(settings.J * (1.0 - settings.Jspread), settings.J * (1.0 + settings.Jspread));
+
+    // Sites are numbered with x varying fastest.
+    auto index = [&](size_t x, size_t y, size_t z) { return (z * ny + y) * nx + x; };
+
+    {
+        std::ofstream out;
+        create(xyzFile, out);
+        outputBuffer writer(out);
+        for (size_t z = 0; z < nz; z++)
+            for (size_t y = 0; y < ny; y++)
+                for (size_t x = 0; x < nx; x++)
+                {
+                    double dx = 0.0, dy = 0.0, dz = 0.0;
+                    if (settings.positional > 0.0)
+                    {
+                        dx = offset(rng);
+                        dy = offset(rng);
+                        dz = offset(rng);
+                    }
+                    double E = (settings.sigma > 0.0) ? energy(rng) : 0.0;
+                    writer.line("%.6f %.6f %.6f C %.6f\n", x * settings.spacing + dx, y * settings.spacing + dy, z * settings.spacing + dz, E);
+                }
+    }
+
+    {
+        std::ofstream out;
+        create(edgeFile, out);
+        outputBuffer writer(out);
+        for (size_t z = 0; z < nz; z++)
+            for (size_t y = 0; y < ny; y++)
+                for (size_t x = 0; x < nx; x++)
+                {
+                    size_t i = index(x, y, z);
+                    if (x + 1 < nx) writer.line("%zu %zu %.6f\n", i, index(x + 1, y, z), J(rng));
+                    if (y + 1 < ny) writer.line("%zu %zu %.6f\n", i, index(x, y + 1, z), J(rng));
+                    if (z + 1 < nz) writer.line("%zu %zu %.6f\n", i, index(x, y, z + 1), J(rng));
+                    else if (LatticePeriodicZ(settings)) writer.line("%zu %zu %.6f\n", i, index(x, y, 0), J(rng));
+                }
+    }
+
+    if (!simFile.empty())
+    {
+        std::ofstream out;
+        create(simFile, out);
+        out << "fieldZ " << fieldZ << "\ntemp " << temp << "\nreorg " << reorg << "\n";
+        if (LatticePeriodicZ(settings))
+            out << "periodicZ " << LatticeSizeZ(settings) << "\n";
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "pch.h"
+
+// A synthetic morphology: sites on a simple cubic lattice with Gaussian energetic disorder,
+// each interacting with its nearest neighbours.
+struct latticeSettings
+{
+	// Number of sites along each axis, and the distance between neighbours (Ang).
+	size_t nx = 10, ny = 10, nz = 10;
+	double spacing = 10.0;
+
+	// Standard deviation of the Gaussian site energies (eV), and of the Gaussian displacement of each site from its lattice point (Ang).
+	double sigma = 0.1;
+	double positional = 0.0;
+
+	// Transfer integrals are spread uniformly over J (1 +- Jspread) (eV).
+	double J = 0.01;
+	double Jspread = 0.5;
+
+	// Join the last layer in z to the first, for use with periodicZ = LatticeSizeZ. Needs nz >= 3.
+	bool periodicZ = true;
+
+	// Seed of the random number generator, so the same settings always give the same lattice.
+	unsigned long long seed = 1;
+};
+
+// Settings for a cube of about numSites sites (the nearest cube number).
+latticeSettings CubicLattice(size_t numSites, double sigma);
+
+// Number of sites and of interacting pairs the lattice will have.
+size_t LatticeSites(const latticeSettings& settings);
+size_t LatticePairs(const latticeSettings& settings);
+
+// Whether the last layer in z is joined to the first, i.e. periodicZ is set and there are enough layers.
+bool LatticePeriodicZ(const latticeSettings& settings);
+
+// Period of the lattice in z (Ang), the value of periodicZ in a .sim file.
+double LatticeSizeZ(const latticeSettings& settings);
+
+// Write the lattice as a .xyz file (x y z type energy per site) and .edge file (site1 site2 J per interacting pair),
+// in the formats read by CreateSites. If simFile is given, also write a .sim file at fieldZ, temp and reorg.
+void WriteLattice(const latticeSettings& settings, const std::string& xyzFile, const std::string& edgeFile,
+	const std::string& simFile = "", double fieldZ = 0.001, double temp = 300.0, double reorg = 0.2);
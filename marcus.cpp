@@ -0,0 +1,196 @@
+#include "pch.h"
+#include "marcus.h"
+#include "consts.h"
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Scalar rate, with the loop invariant factors already hoisted.
+    inline double marcusRate(double J2, double dE0, double deltaZ, double fieldZ, double reorg, double prefactor, double rdenom)
+    {
+        double x = dE0 + deltaZ * fieldZ + reorg;
+        return prefactor * J2 * std::exp(-x * x * rdenom);
+    }
+
+    // Constants for exp(x) = 2^n exp(r), with n = round(x / ln2) and |r| <= ln2 / 2 (Cephes).
+    // ln2 is split into a part exactly representable in few bits (C1) and the remainder (C2) so x - n ln2 loses no precision.
+    // exp(r) is found from the Pade form 1 + 2 r P(r^2) / (Q(r^2) - r P(r^2)).
+    const double LOG2E = 1.4426950408889634073599;
+    const double C1 = 6.93145751953125E-1;
+    const double C2 = 1.42860682030941723212E-6;
+    const double P0 = 1.26177193074810590878E-4, P1 = 3.02994407707441961300E-2, P2 = 9.99999999999999999910E-1;
+    const double Q0 = 3.00198505138664455042E-6, Q1 = 2.52448340349684104192E-3, Q2 = 2.27265548208155028766E-1, Q3 = 2.00000000000000000009E0;
+
+    // Below this exp(x) is smaller than the smallest denormal double.
+    const double EXP_MIN = -745.2;
+}
+
+#if defined(__AVX512F__)
+
+namespace
+{
+    // Convert integral doubles in [-2^51, 2^51] to int64 by adding 1.5 * 2^52, which puts the integer in the low mantissa bits.
+    // (Avoids _mm512_cvtpd_epi64, which needs AVX-512DQ.)
+    inline __m512i toInt64(__m512d n)
+    {
+        const __m512d magic = _mm512_set1_pd(6755399441055744.0);
+        return _mm512_sub_epi64(_mm512_castpd_si512(_mm512_add_pd(n, magic)), _mm512_castpd_si512(magic));
+    }
+
+    // 2^n for integral n in [-1022, 1023]
+    inline __m512d pow2(__m512d n)
+    {
+        return _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_add_epi64(toInt64(n), _mm512_set1_epi64(1023)), 52));
+    }
+
+    // exp(x) for x <= 0.
+    inline __m512d expNeg(__m512d x)
+    {
+        __mmask8 under = _mm512_cmp_pd_mask(x, _mm512_set1_pd(EXP_MIN), _CMP_LT_OQ);
+        x = _mm512_max_pd(x, _mm512_set1_pd(EXP_MIN));
+
+        __m512d n = _mm512_roundscale_pd(_mm512_mul_pd(x, _mm512_set1_pd(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m512d r = _mm512_fnmadd_pd(n, _mm512_set1_pd(C1), x);
+        r = _mm512_fnmadd_pd(n, _mm512_set1_pd(C2), r);
+
+        __m512d rr = _mm512_mul_pd(r, r);
+        __m512d px = _mm512_fmadd_pd(_mm512_fmadd_pd(_mm512_set1_pd(P0), rr, _mm512_set1_pd(P1)), rr, _mm512_set1_pd(P2));
+        px = _mm512_mul_pd(px, r);
+        __m512d qx = _mm512_fmadd_pd(_mm512_fmadd_pd(_mm512_fmadd_pd(_mm512_set1_pd(Q0), rr, _mm512_set1_pd(Q1)), rr, _mm512_set1_pd(Q2)), rr, _mm512_set1_pd(Q3));
+        __m512d e = _mm512_div_pd(px, _mm512_sub_pd(qx, px));
+        e = _mm512_fmadd_pd(_mm512_set1_pd(2.0), e, _mm512_set1_pd(1.0));
+
+        // Scale by 2^n in two steps, so results in the denormal range (n < -1022) are still correct.
+        __m512d n1 = _mm512_roundscale_pd(_mm512_mul_pd(n, _mm512_set1_pd(0.5)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        __m512d n2 = _mm512_sub_pd(n, n1);
+        e = _mm512_mul_pd(_mm512_mul_pd(e, pow2(n1)), pow2(n2));
+
+        return _mm512_mask_blend_pd(under, e, _mm512_setzero_pd());
+    }
+}
+
+void MarcusRates(size_t n, const double* J2, const double* dE0, const double* deltaZ,
+    double fieldZ, double reorg, double prefactor, double rdenom, double* rate)
+{
+    const __m512d vF = _mm512_set1_pd(fieldZ), vReorg = _mm512_set1_pd(reorg);
+    const __m512d vPre = _mm512_set1_pd(prefactor), vNegRdenom = _mm512_set1_pd(-rdenom);
+
+    size_t e = 0;
+    for (; e + 8 <= n; e += 8)
+    {
+        __m512d x = _mm512_add_pd(_mm512_fmadd_pd(_mm512_loadu_pd(deltaZ + e), vF, _mm512_loadu_pd(dE0 + e)), vReorg);
+        __m512d ex = expNeg(_mm512_mul_pd(_mm512_mul_pd(x, x), vNegRdenom));
+        _mm512_storeu_pd(rate + e, _mm512_mul_pd(_mm512_mul_pd(vPre, _mm512_loadu_pd(J2 + e)), ex));
+    }
+    for (; e < n; e++)
+        rate[e] = marcusRate(J2[e], dE0[e], deltaZ[e], fieldZ, reorg, prefactor, rdenom);
+}
+
+const char* MarcusRatesISA() { return "avx512"; }
+
+#elif defined(__AVX2__)
+
+namespace
+{
+    // Convert integral doubles in [-2^51, 2^51] to int64 by adding 1.5 * 2^52, which puts the integer in the low mantissa bits.
+    inline __m256i toInt64(__m256d n)
+    {
+        const __m256d magic = _mm256_set1_pd(6755399441055744.0);
+        return _mm256_sub_epi64(_mm256_castpd_si256(_mm256_add_pd(n, magic)), _mm256_castpd_si256(magic));
+    }
+
+    // 2^n for integral n in [-1022, 1023]
+    inline __m256d pow2(__m256d n)
+    {
+        return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(toInt64(n), _mm256_set1_epi64x(1023)), 52));
+    }
+
+    // exp(x) for x <= 0.
+    inline __m256d expNeg(__m256d x)
+    {
+        __m256d under = _mm256_cmp_pd(x, _mm256_set1_pd(EXP_MIN), _CMP_LT_OQ);
+        x = _mm256_max_pd(x, _mm256_set1_pd(EXP_MIN));
+
+        __m256d n = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256d r = _mm256_fnmadd_pd(n, _mm256_set1_pd(C1), x);
+        r = _mm256_fnmadd_pd(n, _mm256_set1_pd(C2), r);
+
+        __m256d rr = _mm256_mul_pd(r, r);
+        __m256d px = _mm256_fmadd_pd(_mm256_fmadd_pd(_mm256_set1_pd(P0), rr, _mm256_set1_pd(P1)), rr, _mm256_set1_pd(P2));
+        px = _mm256_mul_pd(px, r);
+        __m256d qx = _mm256_fmadd_pd(_mm256_fmadd_pd(_mm256_fmadd_pd(_mm256_set1_pd(Q0), rr, _mm256_set1_pd(Q1)), rr, _mm256_set1_pd(Q2)), rr, _mm256_set1_pd(Q3));
+        __m256d e = _mm256_div_pd(px, _mm256_sub_pd(qx, px));
+        e = _mm256_fmadd_pd(_mm256_set1_pd(2.0), e, _mm256_set1_pd(1.0));
+
+        // Scale by 2^n in two steps, so results in the denormal range (n < -1022) are still correct.
+        __m256d n1 = _mm256_floor_pd(_mm256_mul_pd(n, _mm256_set1_pd(0.5)));
+        __m256d n2 = _mm256_sub_pd(n, n1);
+        e = _mm256_mul_pd(_mm256_mul_pd(e, pow2(n1)), pow2(n2));
+
+        return _mm256_blendv_pd(e, _mm256_setzero_pd(), under);
+    }
+}
+
+void MarcusRates(size_t n, const double* J2, const double* dE0, const double* deltaZ,
+    double fieldZ, double reorg, double prefactor, double rdenom, double* rate)
+{
+    const __m256d vF = _mm256_set1_pd(fieldZ), vReorg = _mm256_set1_pd(reorg);
+    const __m256d vPre = _mm256_set1_pd(prefactor), vNegRdenom = _mm256_set1_pd(-rdenom);
+
+    size_t e = 0;
+    for (; e + 4 <= n; e += 4)
+    {
+        __m256d x = _mm256_add_pd(_mm256_fmadd_pd(_mm256_loadu_pd(deltaZ + e), vF, _mm256_loadu_pd(dE0 + e)), vReorg);
+        __m256d ex = expNeg(_mm256_mul_pd(_mm256_mul_pd(x, x), vNegRdenom));
+        _mm256_storeu_pd(rate + e, _mm256_mul_pd(_mm256_mul_pd(vPre, _mm256_loadu_pd(J2 + e)), ex));
+    }
+    for (; e < n; e++)
+        rate[e] = marcusRate(J2[e], dE0[e], deltaZ[e], fieldZ, reorg, prefactor, rdenom);
+}
+
+const char* MarcusRatesISA() { return "avx2"; }
+
+#else
+
+void MarcusRates(size_t n, const double* J2, const double* dE0, const double* deltaZ,
+    double fieldZ, double reorg, double prefactor, double rdenom, double* rate)
+{
+    for (size_t e = 0; e < n; e++)
+        rate[e] = marcusRate(J2[e], dE0[e], deltaZ[e], fieldZ, reorg, prefactor, rdenom);
+}
+
+const char* MarcusRatesISA() { return "scalar"; }
+
+#endif
+
+void MarcusLogRates(size_t n, const double* J2, const double* dE0, const double* deltaZ,
+    double fieldZ, double reorg, double logPrefactor, double rdenom, double* logRate)
+{
+    for (size_t e = 0; e < n; e++)
+    {
+        double x = dE0[e] + deltaZ[e] * fieldZ + reorg;
+        logRate[e] = logPrefactor + std::log(J2[e]) - x * x * rdenom;
+    }
+}
+
+double CheckMarcusRates(size_t n, const double* J2, const double* dE0, const double* deltaZ,
+    double fieldZ, double reorg, double kBT)
+{
+    std::vector<double> rate(n);
+    MarcusRates(n, J2, dE0, deltaZ, fieldZ, reorg, ((2 * pi) / hbar) * std::pow(4 * pi * reorg * kBT, -0.5), 1.0 / (4 * reorg * kBT), rate.data());
+
+    double worst = 0.0;
+    for (size_t e = 0; e < n; e++)
+    {
+        double ref = ((2 * pi) / hbar) * J2[e] * std::pow(4 * pi * reorg * kBT, -0.5) * std::exp(-1 * std::pow(dE0[e] + deltaZ[e] * fieldZ + reorg, 2) / (4 * reorg * kBT));
+
+        // Rates too small to be normal doubles are compared absolutely.
+        double diff = std::abs(rate[e] - ref) / std::max(std::abs(ref), std::numeric_limits<double>::min());
+        if (diff > worst) worst = diff;
+    }
+
+    return worst;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "pch.h"
+
+// Evaluate the Marcus transfer rate along n edges in a single pass:
+//     rate[e] = prefactor * J2[e] * exp(-(dE0[e] + deltaZ[e] * fieldZ + reorg)^2 * rdenom)
+// where prefactor = (2 pi / hbar) (4 pi reorg kBT)^-1/2 and rdenom = 1 / (4 reorg kBT) are hoisted out by the caller.
+// Uses AVX-512 or AVX2 (with FMA) when the compiler targets them, otherwise a scalar loop.
+void MarcusRates(size_t n, const double* J2, const double* dE0, const double* deltaZ,
+	double fieldZ, double reorg, double prefactor, double rdenom, double* rate);
+
+// As MarcusRates, but the natural log of each rate, which can't underflow however slow the transfer:
+//     logRate[e] = logPrefactor + log(J2[e]) - (dE0[e] + deltaZ[e] * fieldZ + reorg)^2 * rdenom
+void MarcusLogRates(size_t n, const double* J2, const double* dE0, const double* deltaZ,
+	double fieldZ, double reorg, double logPrefactor, double rdenom, double* logRate);
+
+// The instruction set MarcusRates was compiled for ("avx512", "avx2" or "scalar").
+const char* MarcusRatesISA();
+
+// Largest relative difference between the rates from MarcusRates and those from the
+// original one-rate-at-a-time formula (using std::pow and std::exp) over the same edges.
+double CheckMarcusRates(size_t n, const double* J2, const double* dE0, const double* deltaZ,
+	double fieldZ, double reorg, double kBT);
+
+// Largest deviation CheckMarcusRates may find before the kernel is treated as wrong (see benchmark).
+// The two evaluations differ in rounding of the exponent, so the deviation grows with its size: on 0.1 eV disorder lattices
+// it is about 2e-15 at 300 K and 1e-14 at 50 K, and it can reach 1e-10 where exp underflows into the denormal range.
+// A kernel with a wrong coefficient or range reduction deviates by far more.
+const double marcusRatesTol = 1e-9;
@@ -0,0 +1,173 @@
+#include "pch.h"
+#include "ordering.h"
+
+namespace
+{
+    // Breadth first search from root, filling visit with the sites reached in order and setting depth for each of them.
+    // depth must be siteGraph::none for every site on entry, and is restored to that on return.
+    // Returns the number of levels, and sets lastLevelStart to the position in visit of the first site of the final level.
+    size_t levels(const siteGraph& graph, size_t root, std::vector<size_t>& depth, std::vector<size_t>& visit, size_t& lastLevelStart)
+    {
+        visit.clear();
+        visit.push_back(root);
+        depth[root] = 0;
+        for (size_t k = 0; k < visit.size(); k++)
+        {
+            size_t s = visit[k];
+            for (size_t e = graph.offset[s]; e < graph.offset[s + 1]; e++)
+            {
+                size_t d = graph.dest[e];
+                if (depth[d] == siteGraph::none)
+                {
+                    depth[d] = depth[s] + 1;
+                    visit.push_back(d);
+                }
+            }
+        }
+
+        size_t numLevels = depth[visit.back()] + 1;
+        lastLevelStart = visit.size() - 1;
+        while (lastLevelStart > 0 && depth[visit[lastLevelStart - 1]] == numLevels - 1)
+            lastLevelStart--;
+
+        for (size_t k = 0; k < visit.size(); k++)
+            depth[visit[k]] = siteGraph::none;
+        return numLevels;
+    }
+
+    // Spread the bits of a 21 bit integer so there are two zero bits between each.
+    uint64_t spreadBits(uint64_t x)
+    {
+        x &= 0x1fffff;
+        x = (x | x << 32) & 0x1f00000000ffffULL;
+        x = (x | x << 16) & 0x1f0000ff0000ffULL;
+        x = (x | x << 8) & 0x100f00f00f00f00fULL;
+        x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+        x = (x | x << 2) & 0x1249249249249249ULL;
+        return x;
+    }
+}
+
+std::vector<size_t> ReverseCuthillMcKee(const siteGraph& graph)
+{
+    const size_t M = graph.numSites();
+    std::vector<size_t> order;
+    order.reserve(M);
+    std::vector<bool> numbered(M, false);
+    std::vector<size_t> depth(M, siteGraph::none), visit, neighbours;
+
+    for (size_t s = 0; s < M; s++)
+    {
+        if (numbered[s]) continue;
+
+        // Start from a pseudo-peripheral site of this component (George and Liu): begin with the site of lowest degree,
+        // and move to the lowest degree site of the last level for as long as that increases the number of levels.
+        size_t lastStart;
+        levels(graph, s, depth, visit, lastStart);
+        size_t root = s;
+        for (size_t k = 0; k < visit.size(); k++)
+            if (graph.degree(visit[k]) < graph.degree(root)) root = visit[k];
+
+        size_t numLevels = levels(graph, root, depth, visit, lastStart);
+        while (true)
+        {
+            size_t candidate = visit[lastStart];
+            for (size_t k = lastStart; k < visit.size(); k++)
+                if (graph.degree(visit[k]) < graph.degree(candidate)) candidate = visit[k];
+
+            size_t candidateLevels = levels(graph, candidate, depth, visit, lastStart);
+            if (candidateLevels <= numLevels) break;
+            root = candidate;
+            numLevels = candidateLevels;
+        }
+
+        // Cuthill-McKee: number the component breadth first, adding the neighbours of each site in order of increasing degree.
+        size_t first = order.size();
+        order.push_back(root);
+        numbered[root] = true;
+        for (size_t k = first; k < order.size(); k++)
+        {
+            size_t v = order[k];
+            neighbours.clear();
+            for (size_t e = graph.offset[v]; e < graph.offset[v + 1]; e++)
+                if (!numbered[graph.dest[e]])
+                {
+                    neighbours.push_back(graph.dest[e]);
+                    numbered[graph.dest[e]] = true;
+                }
+            std::stable_sort(neighbours.begin(), neighbours.end(), [&](size_t a, size_t b) { return graph.degree(a) < graph.degree(b); });
+            order.insert(order.end(), neighbours.begin(), neighbours.end());
+        }
+    }
+
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+std::vector<size_t> MortonOrder(const std::vector<site>& sites)
+{
+    const size_t M = sites.size();
+    std::vector<size_t> order(M);
+    if (M == 0) return order;
+
+    double lo[3] = { sites[0].pos.X, sites[0].pos.Y, sites[0].pos.Z };
+    double hi[3] = { lo[0], lo[1], lo[2] };
+    for (size_t s = 0; s < M; s++)
+    {
+        const double p[3] = { sites[s].pos.X, sites[s].pos.Y, sites[s].pos.Z };
+        for (int a = 0; a < 3; a++)
+        {
+            lo[a] = std::min(lo[a], p[a]);
+            hi[a] = std::max(hi[a], p[a]);
+        }
+    }
+
+    std::vector<uint64_t> code(M);
+    for (size_t s = 0; s < M; s++)
+    {
+        const double p[3] = { sites[s].pos.X, sites[s].pos.Y, sites[s].pos.Z };
+        uint64_t q[3];
+        for (int a = 0; a < 3; a++)
+            q[a] = (hi[a] > lo[a]) ? (uint64_t)((p[a] - lo[a]) / (hi[a] - lo[a]) * 0x1fffff) : 0;
+        code[s] = spreadBits(q[0]) | spreadBits(q[1]) << 1 | spreadBits(q[2]) << 2;
+        order[s] = s;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return code[a] < code[b]; });
+    return order;
+}
+
+void PermuteSites(std::vector<site>& sites, siteGraph& graph, const std::vector<size_t>& order)
+{
+    const size_t M = sites.size();
+    std::vector<size_t> index(M);
+    std::vector<site> permuted(M);
+    for (size_t i = 0; i < M; i++)
+    {
+        index[order[i]] = i;
+        permuted[i] = sites[order[i]];
+    }
+
+    // Each interacting pair, once, in the new numbering.
+    std::vector<interaction> interactions;
+    interactions.reserve(graph.numEdges() / 2);
+    for (size_t e = 0; e < graph.numEdges(); e++)
+        if (graph.origin[e] < graph.dest[e])
+            interactions.push_back({ index[graph.origin[e]], index[graph.dest[e]], graph.J[e] });
+
+    bool geometry = !graph.deltaZ.empty();
+    periodicBox box = graph.box;
+    graph = siteGraph(M, interactions);
+    if (geometry)
+        graph.SetGeometry(permuted, box);
+    sites.swap(permuted);
+}
+
+size_t Bandwidth(const siteGraph& graph)
+{
+    size_t bandwidth = 0;
+    for (size_t e = 0; e < graph.numEdges(); e++)
+        if (graph.dest[e] > graph.origin[e])
+            bandwidth = std::max(bandwidth, graph.dest[e] - graph.origin[e]);
+    return bandwidth;
+}
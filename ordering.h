@@ -0,0 +1,26 @@
+#pragma once
+#include "pch.h"
+#include "site.h"
+#include "graph.h"
+
+// Orderings that sites can be renumbered into after they are read.
+// file keeps the order of the input files.
+// rcm is reverse Cuthill-McKee on the site graph, which minimises the bandwidth of the rate matrix.
+// morton sorts sites along a Z-order space filling curve through their positions, keeping neighbours close in memory.
+enum class SiteOrder { file, rcm, morton };
+
+// Each ordering returns order, where order[i] is the (current) index of the site to be numbered i.
+
+// Reverse Cuthill-McKee: breadth first search from a pseudo-peripheral site of each connected component,
+// visiting neighbours in order of increasing degree, then reversed.
+std::vector<size_t> ReverseCuthillMcKee(const siteGraph& graph);
+
+// Sort the sites by the Morton code of their position, quantised to 21 bits per axis within the bounding box.
+std::vector<size_t> MortonOrder(const std::vector<site>& sites);
+
+// Renumber the sites so that new site i is old site order[i], rebuilding the graph to match.
+// If the graph geometry was set it is set again, with the same boundary conditions.
+void PermuteSites(std::vector<site>& sites, siteGraph& graph, const std::vector<size_t>& order);
+
+// Largest |i - j| over all interacting pairs of sites (i, j), i.e. the bandwidth of the rate matrix.
+size_t Bandwidth(const siteGraph& graph);
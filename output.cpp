@@ -0,0 +1,139 @@
+#include "pch.h"
+#include "output.h"
+
+namespace
+{
+    struct binaryOccHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t numSites;
+        uint64_t numSolutions;
+        uint64_t reserved[4];
+    };
+
+    const char binaryOccMagic[8] = { 'M', 'E', 'S', 'O', 'C', 'C', 0, 0 };
+    const uint32_t binaryOccByteOrder = 0x01020304;
+
+    void writeArray(std::ofstream& out, const double* data, size_t n)
+    {
+        out.write((const char*)data, n * sizeof(double));
+    }
+}
+
+void WriteOccupations(const char* filename, OccFormat format, const std::vector<site>& sites, const std::vector<size_t>& index,
+    const std::vector<std::vector<double>>& P, const std::vector<std::vector<double>>& current)
+{
+    const size_t M = sites.size();
+    const size_t numSolutions = P.size();
+    auto internal = [&](size_t j) { return index.empty() ? j : index[j]; };
+
+    std::ofstream out(filename, format == OccFormat::binary ? std::ios::binary : std::ios::out);
+    if (!out) {
+        std::cout << "***ERROR***: Unable to create " << filename << std::endl;
+        exit(-1);
+    }
+
+    if (format == OccFormat::binary)
+    {
+        binaryOccHeader header = {};
+        memcpy(header.magic, binaryOccMagic, sizeof(binaryOccMagic));
+        header.version = binaryOccVersion;
+        header.byteOrder = binaryOccByteOrder;
+        header.numSites = M;
+        header.numSolutions = numSolutions;
+        out.write((const char*)&header, sizeof(header));
+
+        // Each array is gathered into file order, then written in one block.
+        std::vector<double> column(3 * M);
+        for (size_t j = 0; j < M; j++)
+        {
+            const site& st = sites[internal(j)];
+            column[3 * j] = st.pos.X;
+            column[3 * j + 1] = st.pos.Y;
+            column[3 * j + 2] = st.pos.Z;
+        }
+        writeArray(out, column.data(), 3 * M);
+        for (size_t j = 0; j < M; j++)
+            column[j] = sites[internal(j)].energy;
+        writeArray(out, column.data(), M);
+        for (size_t k = 0; k < numSolutions; k++)
+        {
+            for (size_t j = 0; j < M; j++)
+                column[j] = P[k][internal(j)];
+            writeArray(out, column.data(), M);
+            for (size_t j = 0; j < M; j++)
+                column[j] = current[k][internal(j)];
+            writeArray(out, column.data(), M);
+        }
+    }
+    else
+    {
+        outputBuffer writer(out);
+        writer.line("# x y z energy");
+        for (size_t k = 0; k < numSolutions; k++)
+            writer.line(" occProb_%zu outCurrentZ_%zu", k + 1, k + 1);
+        writer.line("\n");
+        for (size_t j = 0; j < M; j++)
+        {
+            const size_t s = internal(j);
+            writer.line("%.6f %.6f %.6f %.6f", sites[s].pos.X, sites[s].pos.Y, sites[s].pos.Z, sites[s].energy);
+            for (size_t k = 0; k < numSolutions; k++)
+                writer.line(" %.10e %.10e", P[k][s], current[k][s]);
+            writer.line("\n");
+        }
+    }
+
+    if (!out) {
+        std::cout << "***ERROR***: Failed writing " << filename << std::endl;
+        exit(-1);
+    }
+}
+
+void WriteFluxMap(const std::string& prefix, const std::vector<site>& sites, const siteGraph& graph, const std::vector<size_t>& index, const fluxMap& flux)
+{
+    const size_t M = sites.size();
+    auto internal = [&](size_t j) { return index.empty() ? j : index[j]; };
+
+    // Number in the input files of each site.
+    std::vector<size_t> fileIndex(M);
+    for (size_t j = 0; j < M; j++)
+        fileIndex[internal(j)] = j;
+
+    const std::string siteFile = prefix + ".sites";
+    const std::string edgeFile = prefix + ".edges";
+    std::ofstream siteOut(siteFile), edgeOut(edgeFile);
+    if (!siteOut || !edgeOut) {
+        std::cout << "***ERROR***: Unable to create " << (siteOut ? edgeFile : siteFile) << std::endl;
+        exit(-1);
+    }
+
+    {
+        outputBuffer writer(siteOut);
+        writer.line("# x y z divergence currentX currentY currentZ\n");
+        for (size_t j = 0; j < M; j++)
+        {
+            const size_t s = internal(j);
+            writer.line("%.6f %.6f %.6f %.10e %.10e %.10e %.10e\n", sites[s].pos.X, sites[s].pos.Y, sites[s].pos.Z,
+                flux.divergence[s], flux.siteX[s], flux.siteY[s], flux.siteZ[s]);
+        }
+    }
+
+    {
+        outputBuffer writer(edgeOut);
+        writer.line("# site1 site2 flux currentX currentY currentZ\n");
+        for (size_t e = 0; e < graph.numEdges(); e++)
+        {
+            const size_t s1 = fileIndex[graph.origin[e]], s2 = fileIndex[graph.dest[e]];
+            if (s1 > s2) continue;
+            const double f = flux.edge[e];
+            writer.line("%zu %zu %.10e %.10e %.10e %.10e\n", s1, s2, f, -f * graph.deltaX[e], -f * graph.deltaY[e], -f * graph.deltaZ[e]);
+        }
+    }
+
+    if (!siteOut || !edgeOut) {
+        std::cout << "***ERROR***: Failed writing " << (siteOut ? edgeFile : siteFile) << std::endl;
+        exit(-1);
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include "pch.h"
+#include "site.h"
+#include "graph.h"
+#include "transporter.h"
+
+// How much is printed to the console.
+// full: everything, including every site, singular value and occupation probability (O(M) lines per solution).
+// summary: settings, counts, solver statistics, velocity and mobility, but nothing per site.
+// quiet: as summary, without the settings and progress messages.
+// Per-site results can be written to an occupation file (WriteOccupations) in any mode.
+enum class OutputMode { full, summary, quiet };
+
+// Format of the occupation file.
+enum class OccFormat { text, binary };
+
+// Lines are formatted into a buffer and written to the stream in large blocks, which is much faster than formatting through the stream.
+class outputBuffer
+{
+private:
+	std::ostream& _out;
+	std::vector<char> _buffer;
+	size_t _used = 0;
+
+public:
+	outputBuffer(std::ostream& out) : _out(out), _buffer(1 << 20) {}
+	~outputBuffer() { flush(); }
+	outputBuffer(const outputBuffer&) = delete;
+	outputBuffer& operator=(const outputBuffer&) = delete;
+
+	// Append printf formatted text. Text that doesn't fit in the space left is formatted again after a flush,
+	// and the buffer grows for any that is longer than the whole buffer.
+	template<typename... Args>
+	void line(const char* format, Args... args)
+	{
+		if (_buffer.size() - _used < 256) flush();
+		int n = snprintf(_buffer.data() + _used, _buffer.size() - _used, format, args...);
+		if (n < 0) return;
+		if ((size_t)n >= _buffer.size() - _used)
+		{
+			flush();
+			if ((size_t)n >= _buffer.size()) _buffer.resize((size_t)n + 1);
+			n = snprintf(_buffer.data(), _buffer.size(), format, args...);
+			if (n < 0) return;
+		}
+		_used += n;
+	}
+
+	void flush()
+	{
+		_out.write(_buffer.data(), _used);
+		_used = 0;
+	}
+};
+
+// Binary occupation files hold the sites and one or more solutions as raw arrays, for reading straight into e.g. numpy.
+// Layout (all values little-endian, every section 8 byte aligned):
+//   header: char[8] "MESOCC\0\0", uint32 version, uint32 0x01020304 (byte order check), uint64 numSites, uint64 numSolutions, 32 bytes reserved
+//   double pos[numSites][3], double energy[numSites],
+//   then for each solution: double occProb[numSites], double outCurrentZ[numSites]
+// The text format has the same columns, one line per site: x y z energy, then occProb outCurrentZ for each solution.
+// outCurrentZ is the gross current in z carried out of the site by its outgoing transfers (transporter::SiteVelocityZ),
+// not the net current through it given in a flux map (fluxMap::siteZ), which shares each pair's net flow between its sites.
+const uint32_t binaryOccVersion = 1;
+
+// Write the occupation probabilities P[k] of each solution k, and the current in z carried out of each site current[k] (Ang/s, see
+// transporter::SiteVelocityZ), in a single pass. If index isn't empty, site j of the input files is sites[index[j]], and the
+// sites are written in the order of the input files.
+void WriteOccupations(const char* filename, OccFormat format, const std::vector<site>& sites, const std::vector<size_t>& index,
+	const std::vector<std::vector<double>>& P, const std::vector<std::vector<double>>& current);
+
+// Write a flux map for visualisation, in two text files in the site numbering of the input files:
+//   <prefix>.sites, one line per site: x y z divergence currentX currentY currentZ
+//   <prefix>.edges, one line per interacting pair (site1 < site2): site1 site2 flux currentX currentY currentZ
+// where flux is the net rate of transfer from site1 to site2 (1/s), and the currents (Ang/s) are net currents, defined and signed
+// as in fluxMap: a pair's is its flux times its displacement, and a site's is half the sum of those of its pairs.
+// If index isn't empty, site j of the input files is sites[index[j]].
+void WriteFluxMap(const std::string& prefix, const std::vector<site>& sites, const siteGraph& graph, const std::vector<size_t>& index, const fluxMap& flux);
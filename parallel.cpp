@@ -0,0 +1,21 @@
+#include "pch.h"
+#include "parallel.h"
+
+namespace
+{
+    unsigned int numThreads = 0;
+}
+
+unsigned int NumThreads()
+{
+    if (numThreads > 0)
+        return numThreads;
+
+    unsigned int n = std::thread::hardware_concurrency();
+    return (n > 0) ? n : 1;
+}
+
+void SetNumThreads(unsigned int n)
+{
+    numThreads = n;
+}
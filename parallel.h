@@ -0,0 +1,83 @@
+#pragma once
+#include "pch.h"
+
+// Number of threads used by parallel loops. Defaults to the number of hardware threads.
+unsigned int NumThreads();
+
+// Set the number of threads used by parallel loops. 0 restores the default.
+void SetNumThreads(unsigned int n);
+
+// Number of indices handled together by ParallelBlocks and ParallelSum.
+// Fixed, rather than derived from the number of threads, so that results don't depend on the thread count.
+const size_t parallelBlockSize = 4096;
+
+// True while the calling thread is running the body of a ParallelFor.
+// Loops nested inside another parallel loop then run serially rather than oversubscribing the cores.
+inline bool& InParallelRegion()
+{
+	thread_local bool inside = false;
+	return inside;
+}
+
+// Call f(i) for every i in [0, count), sharing the calls between NumThreads() threads.
+// Each thread takes the next unprocessed i, so f should only write to data owned by index i.
+template<typename F>
+void ParallelFor(size_t count, const F& f)
+{
+	size_t nThreads = std::min<size_t>(NumThreads(), count);
+	if (nThreads <= 1 || InParallelRegion())
+	{
+		for (size_t i = 0; i < count; i++)
+			f(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		InParallelRegion() = true;
+		for (size_t i = next++; i < count; i = next++)
+			f(i);
+		InParallelRegion() = false;
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t t = 1; t < nThreads; t++)
+		threads.emplace_back(worker);
+	worker();
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+}
+
+// Call f(b, begin, end) for each block b of parallelBlockSize consecutive indices [begin, end) covering [0, count).
+// Blocks are shared between threads as in ParallelFor.
+template<typename F>
+void ParallelBlocks(size_t count, const F& f)
+{
+	size_t numBlocks = (count + parallelBlockSize - 1) / parallelBlockSize;
+	ParallelFor(numBlocks, [&](size_t b)
+	{
+		f(b, b * parallelBlockSize, std::min(count, (b + 1) * parallelBlockSize));
+	});
+}
+
+// Sum term(i) over [0, count) in parallel.
+// Each block is summed in index order and the block sums are then added in block order,
+// so the result is bit-for-bit the same for any number of threads.
+template<typename F>
+double ParallelSum(size_t count, const F& term)
+{
+	std::vector<double> partial((count + parallelBlockSize - 1) / parallelBlockSize, 0.0);
+	ParallelBlocks(count, [&](size_t b, size_t begin, size_t end)
+	{
+		double sum = 0.0;
+		for (size_t i = begin; i < end; i++)
+			sum += term(i);
+		partial[b] = sum;
+	});
+
+	double sum = 0.0;
+	for (size_t b = 0; b < partial.size(); b++)
+		sum += partial[b];
+	return sum;
+}
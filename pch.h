@@ -10,10 +10,29 @@
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <limits>
+#include <cstring>
+#include <charconv>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <filesystem>
 #include "gsl/gsl_vector.h"
 #include "gsl/gsl_matrix.h"
 #include "gsl/gsl_linalg.h"
 #include "gsl/gsl_blas.h"
 
+#ifndef _MSC_VER
+// Equivalents of the MSVC bounds checked string functions used in parsing the command line.
+template<size_t N> inline int strcpy_s(char (&dest)[N], const char* src)
+{
+	std::strncpy(dest, src, N - 1);
+	dest[N - 1] = '\0';
+	return 0;
+}
+inline char* strtok_s(char* str, const char* delim, char** context) { return strtok_r(str, delim, context); }
+#endif
+
 #endif
 
@@ -0,0 +1,305 @@
+#include "pch.h"
+#include "profile.h"
+#include "parallel.h"
+#include "marcus.h"
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    // Constant initialised, so safe to use from allocations made before main (by other static initialisers).
+    std::atomic<bool> counting(false);
+    std::atomic<size_t> allocatedBytes(0);
+    std::atomic<size_t> allocationCount(0);
+
+    // Allocate as the standard operator new does, calling the new handler until it succeeds or there is no handler.
+    // Returns nullptr on failure; the handler may throw.
+    void* countedAlloc(size_t size)
+    {
+        if (counting.load(std::memory_order_relaxed))
+        {
+            allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+            allocationCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (size == 0) size = 1;
+        for (;;)
+        {
+            if (void* p = std::malloc(size))
+                return p;
+            std::new_handler handler = std::get_new_handler();
+            if (!handler)
+                return nullptr;
+            handler();
+        }
+    }
+
+    void* nothrowAlloc(size_t size) noexcept
+    {
+        try
+        {
+            return countedAlloc(size);
+        }
+        catch (...)
+        {
+            return nullptr;
+        }
+    }
+
+    struct stageRecord
+    {
+        std::string name;
+        double start; // s, since StartProfile
+        double wall;
+        double cpu;
+        size_t bytes;
+        size_t allocations;
+        double peakRSS;
+        std::vector<std::pair<std::string, double>> metrics;
+    };
+
+    bool profiling = false;
+    std::string profileFile;
+    std::vector<std::string> commandLine;
+    std::chrono::steady_clock::time_point startTime;
+    std::mutex recordMutex;
+    std::vector<stageRecord> records;
+
+    double secondsSinceStart()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    }
+
+    // Write a string as a JSON string literal.
+    void writeString(std::ostream& out, const std::string& str)
+    {
+        out << '"';
+        for (size_t i = 0; i < str.size(); i++)
+        {
+            char c = str[i];
+            if (c == '"' || c == '\\') out << '\\' << c;
+            else if (c == '\n') out << "\\n";
+            else if (c == '\t') out << "\\t";
+            else if ((unsigned char)c < 0x20) out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec << std::setfill(' ');
+            else out << c;
+        }
+        out << '"';
+    }
+
+    // JSON has no infinity or NaN, so those are written as null.
+    void writeNumber(std::ostream& out, double value)
+    {
+        if (std::isfinite(value)) out << value;
+        else out << "null";
+    }
+
+    void writeProfile()
+    {
+        std::lock_guard<std::mutex> lock(recordMutex);
+        std::ofstream out(profileFile);
+        if (!out) {
+            std::cout << "***ERROR***: Unable to create " << profileFile << std::endl;
+            return;
+        }
+        out << std::setprecision(9);
+
+        out << "{\n  \"commandLine\": [";
+        for (size_t i = 0; i < commandLine.size(); i++)
+        {
+            if (i > 0) out << ", ";
+            writeString(out, commandLine[i]);
+        }
+        out << "],\n  \"threads\": " << NumThreads()
+            << ",\n  \"rateKernel\": \"" << MarcusRatesISA() << "\""
+            << ",\n  \"wall_s\": " << secondsSinceStart()
+            << ",\n  \"cpu_s\": " << ProcessCPUTime()
+            << ",\n  \"allocatedBytes\": " << AllocatedBytes()
+            << ",\n  \"allocations\": " << Allocations()
+            << ",\n  \"peakRSS_MB\": " << PeakRSS()
+            << ",\n  \"stages\": [";
+        for (size_t s = 0; s < records.size(); s++)
+        {
+            const stageRecord& r = records[s];
+            out << (s > 0 ? "," : "") << "\n    { \"name\": ";
+            writeString(out, r.name);
+            out << ", \"start_s\": " << r.start << ", \"wall_s\": " << r.wall << ", \"cpu_s\": " << r.cpu
+                << ", \"allocatedBytes\": " << r.bytes << ", \"allocations\": " << r.allocations << ", \"peakRSS_MB\": " << r.peakRSS;
+            for (size_t m = 0; m < r.metrics.size(); m++)
+            {
+                out << ", ";
+                writeString(out, r.metrics[m].first);
+                out << ": ";
+                writeNumber(out, r.metrics[m].second);
+            }
+            out << " }";
+        }
+        out << "\n  ]\n}\n";
+    }
+}
+
+// Every allocation through operator new (including those of the standard containers) goes through countedAlloc,
+// which counts it while profiling.
+// The array and nothrow forms are replaced too, as not every standard library forwards them to the plain form.
+void* operator new(size_t size)
+{
+    void* p = countedAlloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size)
+{
+    void* p = countedAlloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return nothrowAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return nothrowAlloc(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+void StartProfile(const std::string& filename, int argc, char* argv[])
+{
+    profileFile = filename;
+    commandLine.assign(argv, argv + argc);
+    startTime = std::chrono::steady_clock::now();
+    if (!profiling)
+        std::atexit(writeProfile);
+    profiling = true;
+    counting.store(true, std::memory_order_relaxed);
+}
+
+bool Profiling()
+{
+    return profiling;
+}
+
+size_t AllocatedBytes()
+{
+    return allocatedBytes.load(std::memory_order_relaxed);
+}
+
+size_t Allocations()
+{
+    return allocationCount.load(std::memory_order_relaxed);
+}
+
+double ProcessCPUTime()
+{
+#ifdef _WIN32
+    FILETIME creation, exitTime, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exitTime, &kernel, &user))
+        return 0.0;
+    // FILETIMEs count 100 ns intervals.
+    auto seconds = [](const FILETIME& t) { return (((unsigned long long)t.dwHighDateTime << 32) | t.dwLowDateTime) * 1e-7; };
+    return seconds(kernel) + seconds(user);
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + 1e-6 * (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+#endif
+}
+
+double PeakRSS()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize / 1048576.0;
+    return 0.0;
+#else
+#if defined(__linux__)
+    // VmHWM, unlike ru_maxrss, follows ResetPeakRSS.
+    std::ifstream status("/proc/self/status");
+    std::string word;
+    while (status >> word)
+        if (word == "VmHWM:")
+        {
+            double kB;
+            status >> kB;
+            return kB / 1024.0;
+        }
+#endif
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1048576.0; // bytes
+#else
+    return usage.ru_maxrss / 1024.0; // kB
+#endif
+#endif
+}
+
+void ResetPeakRSS()
+{
+#if defined(__linux__)
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5";
+#endif
+}
+
+profileStage::profileStage(const std::string& name) :
+    _running(profiling),
+    _wall(0.0),
+    _cpu(0.0),
+    _bytes(0),
+    _allocations(0)
+{
+    if (!_running) return;
+    _name = name;
+    _wall = secondsSinceStart();
+    _cpu = ProcessCPUTime();
+    _bytes = AllocatedBytes();
+    _allocations = Allocations();
+}
+
+profileStage::~profileStage()
+{
+    End();
+}
+
+void profileStage::Set(const std::string& key, double value)
+{
+    if (!_running) return;
+    for (size_t m = 0; m < _metrics.size(); m++)
+        if (_metrics[m].first == key)
+        {
+            _metrics[m].second = value;
+            return;
+        }
+    _metrics.push_back({ key, value });
+}
+
+void profileStage::End()
+{
+    if (!_running) return;
+    _running = false;
+
+    stageRecord r;
+    r.name = _name;
+    r.start = _wall;
+    r.wall = secondsSinceStart() - _wall;
+    r.cpu = ProcessCPUTime() - _cpu;
+    r.bytes = AllocatedBytes() - _bytes;
+    r.allocations = Allocations() - _allocations;
+    r.peakRSS = PeakRSS();
+    r.metrics.swap(_metrics);
+
+    std::lock_guard<std::mutex> lock(recordMutex);
+    records.push_back(std::move(r));
+}
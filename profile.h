@@ -0,0 +1,52 @@
+#pragma once
+#include "pch.h"
+
+// Instrumentation of the stages of a calculation (parsing, graph building, rate evaluation, assembly, solving, ...).
+// Each stage records its wall and CPU time, the bytes allocated while it ran, and any metrics it is given
+// (non-zero elements, iterations, residuals, ...). Once StartProfile has been called the stages are written
+// as a JSON report when the program exits, including on an error exit.
+
+// Start recording stages, to be written to filename at exit along with the command line.
+void StartProfile(const std::string& filename, int argc, char* argv[]);
+
+// Whether StartProfile has been called. Stages cost almost nothing when it hasn't.
+bool Profiling();
+
+// Total bytes requested from operator new, and the number of calls, since StartProfile was called, over all threads.
+// Allocations are only counted once profiling has started; until then operator new costs a single relaxed load more than malloc.
+size_t AllocatedBytes();
+size_t Allocations();
+
+// CPU time (s) used by the process so far, over all threads.
+double ProcessCPUTime();
+
+// Peak resident set size (MB) of the process.
+double PeakRSS();
+
+// Reset the peak resident set size to the current one, where the platform allows it (Linux); otherwise it's the peak of the whole run.
+void ResetPeakRSS();
+
+// A stage of the calculation, timed from construction until End or destruction, whichever is first.
+class profileStage
+{
+private:
+	std::string _name;
+	bool _running;
+	double _wall;
+	double _cpu;
+	size_t _bytes;
+	size_t _allocations;
+	std::vector<std::pair<std::string, double>> _metrics;
+
+public:
+	profileStage(const std::string& name);
+	~profileStage();
+	profileStage(const profileStage&) = delete;
+	profileStage& operator=(const profileStage&) = delete;
+
+	// Attach a metric to the stage, e.g. Set("iterations", info.iterations). Setting a key again replaces its value.
+	void Set(const std::string& key, double value);
+
+	// Stop timing and record the stage.
+	void End();
+};
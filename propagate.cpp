@@ -0,0 +1,275 @@
+#include "pch.h"
+#include "propagate.h"
+#include "consts.h"
+
+namespace
+{
+    double dot(const std::vector<double>& a, const std::vector<double>& b)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < a.size(); i++)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+    double norm(const std::vector<double>& a)
+    {
+        return std::sqrt(dot(a, a));
+    }
+
+    // Largest absolute row sum of A.
+    double normInf(const sparseMatrix& A)
+    {
+        double largest = 0.0;
+        for (size_t i = 0; i < A.size; i++)
+        {
+            double sum = 0.0;
+            for (size_t k = A.rowStart[i]; k < A.rowStart[i + 1]; k++)
+                sum += std::abs(A.val[k]);
+            largest = std::max(largest, sum);
+        }
+        return largest;
+    }
+
+    // Round a step length up to two significant figures, as Expokit does.
+    double roundStep(double t)
+    {
+        double s = std::pow(10.0, std::floor(std::log10(t)) - 1);
+        return std::ceil(t / s) * s;
+    }
+
+    // Continue w from tNow through each remaining time times[order[next]], ..., by the dense exponential exp(A (t - tNow)) w.
+    // The exponential of A (t - tNow) / 2^s, whose norm is small, is squared s times. exp(A t) of a rate matrix conserves
+    // probability (its columns sum to 1), but rounding in each squaring doubles any error in that, so the columns are
+    // rescaled to sum to 1 after every squaring. Otherwise a long time (many squarings) loses the steady state.
+    void propagateDense(const sparseMatrix& A, double anorm, std::vector<double>& w, double tNow, const std::vector<double>& times,
+        const std::vector<size_t>& order, size_t next, std::vector<std::vector<double>>& Pt)
+    {
+        const size_t n = A.size;
+        gsl_matrix* dense = A.toDense();
+        gsl_matrix* E = gsl_matrix_alloc(n, n);
+        gsl_matrix* E2 = gsl_matrix_alloc(n, n);
+        gsl_vector* w0 = gsl_vector_alloc(n);
+        gsl_vector* wt = gsl_vector_alloc(n);
+        for (; next < order.size(); next++)
+        {
+            double t = times[order[next]];
+            if (t > tNow)
+            {
+                int squarings = std::max(0, (int)std::ceil(std::log2(anorm * (t - tNow))) + 1);
+                gsl_matrix_memcpy(E2, dense);
+                gsl_matrix_scale(E2, std::ldexp(t - tNow, -squarings));
+                gsl_linalg_exponential_ss(E2, E, GSL_PREC_DOUBLE);
+                for (int k = 0; k < squarings; k++)
+                {
+                    gsl_blas_dgemm(CblasNoTrans, CblasNoTrans, 1.0, E, E, 0.0, E2);
+                    for (size_t j = 0; j < n; j++)
+                    {
+                        double sum = 0.0;
+                        for (size_t i = 0; i < n; i++)
+                            sum += gsl_matrix_get(E2, i, j);
+                        for (size_t i = 0; i < n; i++)
+                            gsl_matrix_set(E, i, j, gsl_matrix_get(E2, i, j) / sum);
+                    }
+                }
+
+                for (size_t i = 0; i < n; i++)
+                    gsl_vector_set(w0, i, w[i]);
+                gsl_blas_dgemv(CblasNoTrans, 1.0, E, w0, 0.0, wt);
+                for (size_t i = 0; i < n; i++)
+                    w[i] = gsl_vector_get(wt, i);
+                tNow = t;
+            }
+            Pt[order[next]] = w;
+        }
+        gsl_matrix_free(dense);
+        gsl_matrix_free(E);
+        gsl_matrix_free(E2);
+        gsl_vector_free(w0);
+        gsl_vector_free(wt);
+    }
+}
+
+propagateInfo Propagate(const sparseMatrix& A, const std::vector<double>& P0, const std::vector<double>& times,
+    std::vector<std::vector<double>>& Pt, double tol, int m, int maxSteps, size_t denseMax)
+{
+    const size_t n = A.size;
+    const int maxReject = 10;
+    const double gamma = 0.9; // Safety factor applied to new step lengths
+    const double delta = 1.2; // Allowed excess of the local error over its target
+
+    propagateInfo info;
+    Pt.assign(times.size(), std::vector<double>());
+
+    // Visit the requested times in increasing order, so each is reached by continuing from the one before.
+    std::vector<size_t> order(times.size());
+    for (size_t k = 0; k < order.size(); k++)
+        order[k] = k;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return times[a] < times[b]; });
+
+    std::vector<double> w = P0;
+    double beta = norm(w);
+    double anorm = normInf(A);
+
+    size_t next = 0;
+    if (beta == 0.0 || anorm == 0.0)
+    {
+        // exp(A t) P0 = P0 for all t
+        for (; next < order.size(); next++)
+            Pt[order[next]] = w;
+        info.converged = true;
+        return info;
+    }
+    for (; next < order.size() && times[order[next]] <= 0.0; next++)
+        Pt[order[next]] = w;
+    if (next == order.size())
+    {
+        info.converged = true;
+        return info;
+    }
+
+    // Expokit controls the local error per unit time. Choose that rate so the accumulated error
+    // at the last requested time is tol relative to ||P0||.
+    const double tolRate = tol * beta / times[order.back()];
+
+    double xm = 1.0 / m;
+    double fact = std::pow((m + 1) / std::exp(1.0), m + 1) * std::sqrt(2 * pi * (m + 1));
+    double tNew = roundStep((1.0 / anorm) * std::pow((fact * tolRate) / (4 * beta * anorm), xm));
+    double tNow = 0.0;
+
+    // Arnoldi basis V and Hessenberg matrix H, augmented by two rows and columns for the error estimate.
+    std::vector<std::vector<double>> V(m + 1, std::vector<double>(n));
+    std::vector<double> p(n);
+    gsl_matrix* H = gsl_matrix_alloc(m + 2, m + 2);
+
+    while (next < order.size())
+    {
+        if (info.steps == maxSteps)
+        {
+            // The transient is too stiff for the Krylov steps to reach the remaining times within the budget.
+            info.stepLimit = true;
+            if (n <= denseMax)
+            {
+                propagateDense(A, anorm, w, tNow, times, order, next, Pt);
+                info.dense = true;
+                info.converged = true;
+            }
+            gsl_matrix_free(H);
+            return info;
+        }
+
+        double tOut = times[order[next]];
+        double tStep = std::min(tOut - tNow, tNew);
+
+        // Build an orthonormal basis of the Krylov subspace span{w, A w, ..., A^(m-1) w}, with H = V^T A V.
+        gsl_matrix_set_zero(H);
+        for (size_t i = 0; i < n; i++)
+            V[0][i] = w[i] / beta;
+
+        int mb = m;
+        int k1 = 2; // Becomes 0 if the subspace is invariant ("happy breakdown"), when the projection is exact
+        double breakErr = 0.0;
+        for (int j = 0; j < m; j++)
+        {
+            A.multiply(V[j], p);
+            for (int i = 0; i <= j; i++)
+            {
+                double h = dot(V[i], p);
+                gsl_matrix_set(H, i, j, h);
+                for (size_t k = 0; k < n; k++)
+                    p[k] -= h * V[i][k];
+            }
+
+            // If the part of A V[j] outside the subspace is small enough that neglecting it keeps the error
+            // within tolerance all the way to tOut, the subspace is effectively invariant and one step suffices.
+            double s = norm(p);
+            if (beta * s <= tolRate)
+            {
+                k1 = 0;
+                mb = j + 1;
+                tStep = tOut - tNow;
+                breakErr = beta * s * tStep;
+                break;
+            }
+            gsl_matrix_set(H, j + 1, j, s);
+            for (size_t k = 0; k < n; k++)
+                V[j + 1][k] = p[k] / s;
+        }
+
+        double avnorm = 0.0;
+        if (k1 != 0)
+        {
+            gsl_matrix_set(H, m + 1, m, 1.0);
+            A.multiply(V[m], p);
+            avnorm = norm(p);
+        }
+
+        // Exponentiate the small matrix tStep H, shortening the step until the local error estimate is acceptable.
+        const size_t mx = mb + k1;
+        gsl_matrix* Hs = gsl_matrix_alloc(mx, mx);
+        gsl_matrix* F = gsl_matrix_alloc(mx, mx);
+        double errLoc = 0.0;
+        int reject = 0;
+        while (true)
+        {
+            for (size_t i = 0; i < mx; i++)
+                for (size_t j = 0; j < mx; j++)
+                    gsl_matrix_set(Hs, i, j, tStep * gsl_matrix_get(H, i, j));
+            gsl_linalg_exponential_ss(Hs, F, GSL_PREC_DOUBLE);
+
+            if (k1 == 0)
+            {
+                errLoc = breakErr;
+                break;
+            }
+
+            double phi1 = std::abs(beta * gsl_matrix_get(F, m, 0));
+            double phi2 = std::abs(beta * gsl_matrix_get(F, m + 1, 0) * avnorm);
+            if (phi1 > 10 * phi2) { errLoc = phi2; xm = 1.0 / m; }
+            else if (phi1 > phi2) { errLoc = (phi1 * phi2) / (phi1 - phi2); xm = 1.0 / m; }
+            else { errLoc = phi1; xm = 1.0 / (m - 1); }
+
+            if (errLoc <= delta * tStep * tolRate)
+                break;
+
+            if (reject == maxReject)
+            {
+                // Can't meet the tolerance; times beyond tNow are left without a result.
+                gsl_matrix_free(Hs);
+                gsl_matrix_free(F);
+                gsl_matrix_free(H);
+                return info;
+            }
+            tStep = roundStep(gamma * tStep * std::pow(tStep * tolRate / errLoc, xm));
+            reject++;
+            info.rejected++;
+        }
+
+        // w = beta V F e_1, using the extra basis vector as well unless the subspace was invariant.
+        const size_t mw = mb + std::max(0, k1 - 1);
+        std::fill(w.begin(), w.end(), 0.0);
+        for (size_t j = 0; j < mw; j++)
+        {
+            double c = beta * gsl_matrix_get(F, j, 0);
+            for (size_t k = 0; k < n; k++)
+                w[k] += c * V[j][k];
+        }
+        gsl_matrix_free(Hs);
+        gsl_matrix_free(F);
+
+        beta = norm(w);
+        tNow = (tStep == tOut - tNow) ? tOut : tNow + tStep;
+        info.steps++;
+        info.error += errLoc;
+
+        errLoc = std::max(errLoc, std::numeric_limits<double>::min());
+        tNew = roundStep(gamma * tStep * std::pow(tStep * tolRate / errLoc, xm));
+
+        for (; next < order.size() && times[order[next]] <= tNow; next++)
+            Pt[order[next]] = w;
+    }
+
+    gsl_matrix_free(H);
+    info.converged = true;
+    return info;
+}
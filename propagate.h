@@ -0,0 +1,32 @@
+#pragma once
+#include "pch.h"
+#include "sparse.h"
+
+// Summary of the outcome of a time propagation.
+struct propagateInfo
+{
+	bool converged = false;
+
+	// Number of accepted time steps, and of steps rejected and retried with a shorter step.
+	int steps = 0;
+	int rejected = 0;
+
+	// Sum of the local error estimates of all accepted steps (an estimate of the global error in P(t)).
+	double error = 0.0;
+
+	// Whether the step budget ran out, and whether the times after that were then found by dense exponentials.
+	bool stepLimit = false;
+	bool dense = false;
+};
+
+// Propagate the occupation probabilities P0 in time under the rate matrix A (dP/dt = A P),
+// finding P(t) = exp(A t) P0 at every time in 'times' (in any order) in a single pass.
+// Uses the Krylov subspace method of Expokit (Sidje, ACM TOMS 24, 1998): each step projects A onto an Arnoldi basis
+// of dimension m and exponentiates the small Hessenberg matrix, with the step length chosen so that the estimated
+// local error per unit time stays below tol. Only products with A are needed, so the cost is O(m nnz) per step.
+// Pt[k] is set to P(times[k]).
+// The step length is limited to roughly m / ||A||, so a time much longer than the fastest transfer takes very many steps.
+// After maxSteps accepted steps, systems of up to denseMax sites finish the remaining times by exponentiating the dense
+// matrix by scaling and squaring, O(M^3) per time; larger systems stop there, leaving the later times without a result.
+propagateInfo Propagate(const sparseMatrix& A, const std::vector<double>& P0, const std::vector<double>& times,
+	std::vector<std::vector<double>>& Pt, double tol = 1e-10, int m = 30, int maxSteps = 1000, size_t denseMax = 2000);
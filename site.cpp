@@ -1,6 +1,6 @@
 #include "pch.h"
 #include "site.h"
-#include "transporter.h"
+#include "graph.h"
 #include "consts.h"
 #include "IO.h"
 
@@ -12,119 +12,92 @@ site::site(double x, double y, double z, double E)
     energy = E;
 }
 
-void site::addNeighbour(site* pSite, double J)
-{
-    // Unless already present, add passed site as neighbour to 'this'
-    if (!this->hasNeighbour(pSite))
-    {
-        neighbour* n = new neighbour;
-        n->_pSite = pSite;
-        n->_J = J;
-        neighbours.push_back(n);
-    }
-
-    // Unless already present, add 'this' as neighbour to passed site
-    if (!pSite->hasNeighbour(this))
-    {
-        neighbour* th = new neighbour;
-        th->_pSite = this;
-        th->_J = J;
-        pSite->neighbours.push_back(th);
-    }
-
-}
-
-site::neighbour* site::hasNeighbour(site* pSite)
-{
-    std::vector<neighbour*>::iterator it = neighbours.begin();
-    for (int i = 0; it != neighbours.end(); i++, it++)
-        if ((*it)->_pSite == pSite)
-            return *it;
-
-    return NULL;
-}
-
-
-site::~site()
-{
-    std::vector<neighbour*>::iterator it = neighbours.begin();
-    for (int i = 0; it != neighbours.end(); i++, it++)
-        delete (*it);
-    
-    neighbours.clear();
-}
-
-
 std::ostream& operator<<(std::ostream& os, const site& st)
 {
-    os << "pos = (" << st.pos.X << "," << st.pos.Y << "," << st.pos.Z << "); E = " << st.energy << "; # neighbors = " << st.neighbours.size();
+    os << "pos = (" << st.pos.X << "," << st.pos.Y << "," << st.pos.Z << "); E = " << st.energy;
     return os;
 }
 
-std::vector<site> CreateSites(char* XYZfile, char* EDGEfile)
+std::vector<site> CreateSites(char* XYZfile, char* EDGEfile, siteGraph& graph)
 {
-    std::vector<site> sites;
+    size_t badLine;
+
+    // A binary graph file holds both the sites and the graph, so can be used in place of the text files.
+    std::shared_ptr<mappedFile> xyz = std::make_shared<mappedFile>(XYZfile);
+    if (IsBinaryGraph(*xyz))
+        return ReadGraph(xyz, graph);
 
     // Use contents of .xyz file to populate site vector
     // Columns should be formatted as: x (float), y (float), z (float), site type (char, unused), site energy (float)
-    std::ifstream in;
-    open(XYZfile, in);
-    std::string line;
-
-    int linenum = 0;
-    while (std::getline(in, line))
+    std::vector<site> sites;
     {
-        linenum++;
-        std::stringstream linestream(line);
-        double x, y, z, E;
-        char s;
-        linestream >> x >> y >> z >> s >> E;
+        const mappedFile& in = *xyz;
+        sites = ParseLines<site>(in, [](const char* p, const char* end, site& st)
+        {
+            double x, y, z, E;
+            char s;
+            if (!(ParseValue(p, end, x) && ParseValue(p, end, y) && ParseValue(p, end, z) && ParseValue(p, end, s) && ParseValue(p, end, E)))
+                return false;
 
-        if (linestream.fail())
+            st = site(x, y, z, E);
+            return true;
+        }, badLine);
+
+        if (badLine)
         {
-            std::cout << "***ERROR***: Unexpected formatting of .xyz file at line " << linenum << ". Expected 5 columns with value types; float, float, float, char, float.\n";
-            in.close();
+            std::cout << "***ERROR***: Unexpected formatting of .xyz file at line " << badLine << ". Expected 5 columns with value types; float, float, float, char, float.\n";
             exit(-1);
         }
-
-        sites.push_back(site(x, y, z, E));
+        xyz.reset();
     }
 
-    in.close();
-
     // Use contents of .edge file to set interacting neighbours
     // Columns should be formatted as: site 1 (int), site 2 (int), J (float)
-    open(EDGEfile, in);
-
-    linenum = 0;
-    while (std::getline(in, line))
+    std::vector<interaction> interactions;
     {
-        linenum++;
-        std::stringstream linestream(line);
-        int s1, s2;
-        double J;
-        linestream >> s1 >> s2 >> J;
+        mappedFile in(EDGEfile);
 
-        if (linestream.fail())
+        // Distinguish formatting errors from out of range indices, as both are reported by line.
+        const long long M = (long long)sites.size();
+        std::atomic<bool> outOfRange(false);
+        interactions = ParseLines<interaction>(in, [M, &outOfRange](const char* p, const char* end, interaction& in)
         {
-            std::cout << "***ERROR***: Unexpected formatting of .edge file at line " << linenum << ". Expected 3 columns with value types; int, int, float.\n";
-            in.close();
-            exit(-1);
-        }
-
-        if (s1 >= sites.size() || s2 >= sites.size())
+            long long s1, s2;
+            double J;
+            if (!(ParseValue(p, end, s1) && ParseValue(p, end, s2) && ParseValue(p, end, J)))
+                return false;
+
+            if (s1 < 0 || s2 < 0 || s1 >= M || s2 >= M)
+            {
+                outOfRange = true;
+                return false;
+            }
+
+            in = { (size_t)s1, (size_t)s2, J };
+            return true;
+        }, badLine);
+
+        if (badLine)
         {
-            std::cout << "***ERROR***: Site index out of range in .edge file at line " << linenum << "\n";
-            in.close();
+            // Re-check the offending line to report the right error.
+            const char* p = in.data();
+            for (size_t l = 1; l < badLine; l++)
+                p = (const char*)memchr(p, '\n', in.data() + in.size() - p) + 1;
+            const char* end = (const char*)memchr(p, '\n', in.data() + in.size() - p);
+            if (!end) end = in.data() + in.size();
+
+            long long s1, s2;
+            double J;
+            if (outOfRange && ParseValue(p, end, s1) && ParseValue(p, end, s2) && ParseValue(p, end, J))
+                std::cout << "***ERROR***: Site index out of range in .edge file at line " << badLine << "\n";
+            else
+                std::cout << "***ERROR***: Unexpected formatting of .edge file at line " << badLine << ". Expected 3 columns with value types; int, int, float.\n";
             exit(-1);
         }
-
-        sites[s1].addNeighbour(&sites[s2], J);
-
     }
 
-    in.close();
+    graph = siteGraph(sites.size(), interactions);
 
     return sites;
 
-}
\ No newline at end of file
+}
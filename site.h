@@ -1,32 +1,15 @@
 #pragma once
 #include "pch.h"
 
-//class transporter;
+class siteGraph;
 
 class site 
 {
 private:
 
-	// Transporter can access private members of site.
-	friend class transporter;
-
 	// A structure that will be used to hold the position of the site.
 	struct vec { double X, Y, Z; };
 
-	// Forward declare a structure that will be used to specify
-	// which other sites the parent site interacts with,
-	// and the strength of interactions.
-	// Full definition in transporter.h
-	struct neighbour;
-
-	// The list of neighbors this site interacts with.
-	std::vector<neighbour*> neighbours;
-
-	// Check if this site has the passed pointed-to site as a neighbour.
-	// If it does, return a pointer to the neighbour object.
-	// Otherwise return NULL
-	neighbour* hasNeighbour(site* pSite);
-
 public:
 
 	// The position of the site.
@@ -41,14 +24,21 @@ public:
 	// Construct a site object
 	site(double x, double y, double z, double energy);
 
-	// Give this site a pointer to another site which it interacts with, alongside the associated transfer integral
-	void addNeighbour(site* pSite, double J);
-
-	// Destructor
-	~site();
+	// Construct a site at the origin with zero energy
+	site() : site(0.0, 0.0, 0.0, 0.0) {}
 
 	friend std::ostream& operator<<(std::ostream& os, const site& st);
 
 };
 
-std::vector<site> CreateSites(char* XYZfile, char* EDGEfile);
+// An interaction between two sites (referred to by index), as listed in the .edge file.
+struct interaction
+{
+	size_t s1, s2;
+	double J;
+};
+
+// Read the sites from the .xyz file, and the interactions between them from the .edge file into graph.
+// If XYZfile is a binary graph file (see graph.h) both are read from it instead, and EDGEfile is unused.
+// Sites hold no pointers to each other, so the returned vector can be freely moved or reallocated.
+std::vector<site> CreateSites(char* XYZfile, char* EDGEfile, siteGraph& graph);
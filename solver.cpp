@@ -0,0 +1,525 @@
+#include "pch.h"
+#include "solver.h"
+#include "amg.h"
+
+namespace
+{
+    double dot(const std::vector<double>& a, const std::vector<double>& b)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < a.size(); i++)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+    double norm(const std::vector<double>& a)
+    {
+        return std::sqrt(dot(a, a));
+    }
+
+    // r = b - A x
+    void residual(const sparseMatrix& A, const std::vector<double>& b, const std::vector<double>& x, std::vector<double>& r)
+    {
+        A.multiply(x, r);
+        for (size_t i = 0; i < r.size(); i++)
+            r[i] = b[i] - r[i];
+    }
+
+    // r = b - A x, with each row summed in compensated arithmetic (Ogita, Rump and Oishi's Dot2): the rounding error
+    // of every product is recovered exactly by fma and that of every addition by TwoSum, and the errors summed alongside.
+    // This is as accurate as summing in twice double precision, unlike long double, which is no wider than double with some compilers.
+    // Also sets scale to |A| |x| + |b|, for the componentwise backward error.
+    void compensatedResidual(const sparseMatrix& A, const std::vector<double>& b, const std::vector<double>& x,
+        std::vector<double>& r, std::vector<double>& scale)
+    {
+        r.resize(A.size);
+        scale.resize(A.size);
+        for (size_t i = 0; i < A.size; i++)
+        {
+            double sum = b[i], err = 0.0, size = std::abs(b[i]);
+            for (size_t k = A.rowStart[i]; k < A.rowStart[i + 1]; k++)
+            {
+                double p = -A.val[k] * x[A.col[k]];
+                double pErr = std::fma(-A.val[k], x[A.col[k]], -p);
+                double t = sum + p;
+                double z = t - sum;
+                err += (sum - (t - z)) + (p - z) + pErr;
+                sum = t;
+                size += std::abs(p);
+            }
+            r[i] = sum + err;
+            scale[i] = size;
+        }
+    }
+
+    // Componentwise backward error of x as a solution of B x = b (see solveInfo), and ||b - B x|| / ||b||, from compensatedResidual.
+    void measureSolution(const sparseMatrix& B, const std::vector<double>& b, const std::vector<double>& x, solveInfo& info)
+    {
+        std::vector<double> r, scale;
+        compensatedResidual(B, b, x, r, scale);
+        info.backwardError = 0.0;
+        for (size_t i = 0; i < r.size(); i++)
+            if (scale[i] > 0.0)
+                info.backwardError = std::max(info.backwardError, std::abs(r[i]) / scale[i]);
+
+        double bnorm = norm(b);
+        info.residual = norm(r) / (bnorm == 0.0 ? 1.0 : bnorm);
+    }
+
+    // Iterative refinement of the solution x of B x = b, for at most 'steps' steps: each adds the correction d = solve(r),
+    // for the compensated residual r, as long as that reduces the componentwise backward error.
+    // Returns the number of steps kept.
+    template <typename F>
+    int refineSolution(const sparseMatrix& B, const std::vector<double>& b, std::vector<double>& x, int steps, const F& solve)
+    {
+        std::vector<double> r, scale, d, xNew(x.size());
+        auto backwardError = [&]()
+        {
+            double err = 0.0;
+            for (size_t i = 0; i < r.size(); i++)
+                if (scale[i] > 0.0)
+                    err = std::max(err, std::abs(r[i]) / scale[i]);
+            return err;
+        };
+
+        compensatedResidual(B, b, x, r, scale);
+        double err = backwardError();
+        int kept = 0;
+        while (kept < steps && err > std::numeric_limits<double>::epsilon())
+        {
+            solve(r, d);
+            for (size_t i = 0; i < x.size(); i++)
+                xNew[i] = x[i] + d[i];
+
+            compensatedResidual(B, b, xNew, r, scale);
+            double errNew = backwardError();
+            if (!(errNew < err)) break;
+            x.swap(xNew);
+            err = errNew;
+            kept++;
+        }
+        return kept;
+    }
+
+    // Solve the pinned system B x = b of SteadyState, refine it, and normalise the solution into P.
+    solveInfo pinnedSteadyState(const sparseMatrix& B, const std::vector<double>& b, size_t r, const preconditioner& M,
+        std::vector<double>& P, SolverForm form, double tol, int maxIter, int refine)
+    {
+        // Initial guess, rescaled to satisfy the constraint x[r] = 1.
+        std::vector<double> x(B.size, 1.0);
+        if (P.size() == B.size && P[r] != 0.0)
+            for (size_t i = 0; i < B.size; i++)
+                x[i] = P[i] / P[r];
+
+        solveInfo info;
+        switch (form)
+        {
+        case SolverForm::bicgstab:
+            info = BiCGSTAB(B, b, x, M, tol, maxIter);
+            break;
+
+        case SolverForm::gmres:
+            info = GMRES(B, b, x, M, tol, maxIter);
+            break;
+
+        default:
+            throw std::logic_error("Solver form is not an iterative method.");
+        }
+
+        if (refine > 0)
+        {
+            // Each correction is solved to the same relative tolerance, from a zero initial guess. It is the same system
+            // as the first solve, so is allowed as many iterations as that took: more only chase rounding noise in the residual.
+            int innerIter = std::min(maxIter, std::max(info.iterations, 10));
+            info.refinements = refineSolution(B, b, x, refine, [&](const std::vector<double>& res, std::vector<double>& d)
+            {
+                d.assign(B.size, 0.0);
+                solveInfo inner = (form == SolverForm::gmres) ? GMRES(B, res, d, M, tol, innerIter) : BiCGSTAB(B, res, d, M, tol, innerIter);
+                info.iterations += inner.iterations;
+            });
+        }
+        double krylovResidual = info.residual;
+        measureSolution(B, b, x, info);
+        if (refine > 0)
+            info.converged = info.converged || info.residual <= tol || info.backwardError <= tol;
+        else
+            info.residual = krylovResidual;
+
+        // Normalise so that the probabilities sum to 1.
+        double sum = 0.0;
+        for (size_t i = 0; i < x.size(); i++)
+            sum += x[i];
+        P.resize(B.size);
+        for (size_t i = 0; i < x.size(); i++)
+            P[i] = x[i] / sum;
+
+        return info;
+    }
+}
+
+jacobiPreconditioner::jacobiPreconditioner(const sparseMatrix& A) : _rdiag(A.size, 1.0)
+{
+    for (size_t i = 0; i < A.size; i++)
+    {
+        double d = A.get(i, i);
+        if (d != 0.0) _rdiag[i] = 1.0 / d;
+    }
+}
+
+void jacobiPreconditioner::apply(const std::vector<double>& r, std::vector<double>& z) const
+{
+    z.resize(r.size());
+    for (size_t i = 0; i < r.size(); i++)
+        z[i] = r[i] * _rdiag[i];
+}
+
+size_t PinnedSite(const sparseMatrix& A)
+{
+    size_t r = 0;
+    double largest = -1.0;
+    for (size_t i = 0; i < A.size; i++)
+    {
+        double d = std::abs(A.get(i, i));
+        if (d > largest) { largest = d; r = i; }
+    }
+    return r;
+}
+
+void PinnedSystem(const sparseMatrix& A, size_t r, sparseMatrix& B, std::vector<double>& b)
+{
+    size_t M = A.size;
+    B.size = M;
+    B.rowStart.assign(M + 1, 0);
+    B.col.clear();
+    B.val.clear();
+    B.col.reserve(A.nnz());
+    B.val.reserve(A.nnz());
+    b.assign(M, 0.0);
+
+    for (size_t i = 0; i < M; i++)
+    {
+        B.rowStart[i] = B.val.size();
+        if (i == r)
+        {
+            B.col.push_back(r);
+            B.val.push_back(1.0);
+            b[i] = 1.0;
+            continue;
+        }
+
+        for (size_t k = A.rowStart[i]; k < A.rowStart[i + 1]; k++)
+        {
+            if (A.col[k] == r)
+                b[i] = -A.val[k];
+            else
+            {
+                B.col.push_back(A.col[k]);
+                B.val.push_back(A.val[k]);
+            }
+        }
+    }
+    B.rowStart[M] = B.val.size();
+}
+
+solveInfo BiCGSTAB(const sparseMatrix& A, const std::vector<double>& b, std::vector<double>& x, const preconditioner& M, double tol, int maxIter)
+{
+    size_t n = A.size;
+    solveInfo info;
+    x.resize(n, 0.0);
+
+    double bnorm = norm(b);
+    if (bnorm == 0.0) bnorm = 1.0;
+
+    std::vector<double> r(n), rhat(n), p(n, 0.0), v(n, 0.0), s(n), t(n), phat(n), shat(n);
+    residual(A, b, x, r);
+    rhat = r;
+
+    info.residual = norm(r) / bnorm;
+    if (info.residual <= tol)
+    {
+        info.converged = true;
+        return info;
+    }
+
+    double rho = 1.0, alpha = 1.0, omega = 1.0;
+    for (info.iterations = 1; info.iterations <= maxIter; info.iterations++)
+    {
+        double rhoNew = dot(rhat, r);
+        if (rhoNew == 0.0)
+        {
+            // Breakdown: restart using the current residual as the shadow residual.
+            residual(A, b, x, r);
+            rhat = r;
+            std::fill(p.begin(), p.end(), 0.0);
+            std::fill(v.begin(), v.end(), 0.0);
+            rho = alpha = omega = 1.0;
+            rhoNew = dot(rhat, r);
+            if (rhoNew == 0.0) break;
+        }
+
+        double beta = (rhoNew / rho) * (alpha / omega);
+        rho = rhoNew;
+        for (size_t i = 0; i < n; i++)
+            p[i] = r[i] + beta * (p[i] - omega * v[i]);
+
+        M.apply(p, phat);
+        A.multiply(phat, v);
+        alpha = rho / dot(rhat, v);
+
+        for (size_t i = 0; i < n; i++)
+            s[i] = r[i] - alpha * v[i];
+
+        if (norm(s) / bnorm <= tol)
+        {
+            for (size_t i = 0; i < n; i++)
+                x[i] += alpha * phat[i];
+            info.residual = norm(s) / bnorm;
+            info.converged = true;
+            break;
+        }
+
+        M.apply(s, shat);
+        A.multiply(shat, t);
+        double tt = dot(t, t);
+        omega = (tt > 0.0) ? dot(t, s) / tt : 0.0;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            x[i] += alpha * phat[i] + omega * shat[i];
+            r[i] = s[i] - omega * t[i];
+        }
+
+        info.residual = norm(r) / bnorm;
+        if (info.residual <= tol)
+        {
+            info.converged = true;
+            break;
+        }
+        if (omega == 0.0) break;
+    }
+
+    // Report the true residual rather than the recursively updated one.
+    residual(A, b, x, r);
+    info.residual = norm(r) / bnorm;
+    info.iterations = std::min(info.iterations, maxIter);
+    return info;
+}
+
+solveInfo GMRES(const sparseMatrix& A, const std::vector<double>& b, std::vector<double>& x, const preconditioner& M, double tol, int maxIter, int restart)
+{
+    size_t n = A.size;
+    solveInfo info;
+    x.resize(n, 0.0);
+
+    double bnorm = norm(b);
+    if (bnorm == 0.0) bnorm = 1.0;
+
+    size_t m = (size_t)restart;
+    std::vector<std::vector<double>> V(m + 1, std::vector<double>(n));
+    std::vector<std::vector<double>> Z(m, std::vector<double>(n));
+    std::vector<std::vector<double>> H(m + 1, std::vector<double>(m, 0.0));
+    std::vector<double> cs(m), sn(m), g(m + 1), r(n), w(n);
+
+    while (info.iterations < maxIter)
+    {
+        residual(A, b, x, r);
+        double beta = norm(r);
+        info.residual = beta / bnorm;
+        if (info.residual <= tol)
+        {
+            info.converged = true;
+            return info;
+        }
+
+        for (size_t i = 0; i < n; i++)
+            V[0][i] = r[i] / beta;
+        std::fill(g.begin(), g.end(), 0.0);
+        g[0] = beta;
+
+        // Arnoldi process with modified Gram-Schmidt, applying Givens rotations to keep H upper triangular.
+        size_t j = 0;
+        for (; j < m && info.iterations < maxIter; j++)
+        {
+            info.iterations++;
+            M.apply(V[j], Z[j]);
+            A.multiply(Z[j], w);
+
+            for (size_t k = 0; k <= j; k++)
+            {
+                H[k][j] = dot(w, V[k]);
+                for (size_t i = 0; i < n; i++)
+                    w[i] -= H[k][j] * V[k][i];
+            }
+            H[j + 1][j] = norm(w);
+            if (H[j + 1][j] != 0.0)
+                for (size_t i = 0; i < n; i++)
+                    V[j + 1][i] = w[i] / H[j + 1][j];
+
+            for (size_t k = 0; k < j; k++)
+            {
+                double tmp = cs[k] * H[k][j] + sn[k] * H[k + 1][j];
+                H[k + 1][j] = -sn[k] * H[k][j] + cs[k] * H[k + 1][j];
+                H[k][j] = tmp;
+            }
+            double denom = std::hypot(H[j][j], H[j + 1][j]);
+            cs[j] = (denom != 0.0) ? H[j][j] / denom : 1.0;
+            sn[j] = (denom != 0.0) ? H[j + 1][j] / denom : 0.0;
+            H[j][j] = denom;
+            H[j + 1][j] = 0.0;
+            g[j + 1] = -sn[j] * g[j];
+            g[j] = cs[j] * g[j];
+
+            info.residual = std::abs(g[j + 1]) / bnorm;
+            if (info.residual <= tol)
+            {
+                j++;
+                break;
+            }
+        }
+
+        // Solve the upper triangular least squares problem and update x.
+        std::vector<double> y(j);
+        for (size_t k = j; k-- > 0;)
+        {
+            double sum = g[k];
+            for (size_t l = k + 1; l < j; l++)
+                sum -= H[k][l] * y[l];
+            y[k] = (H[k][k] != 0.0) ? sum / H[k][k] : 0.0;
+        }
+        for (size_t k = 0; k < j; k++)
+            for (size_t i = 0; i < n; i++)
+                x[i] += y[k] * Z[k][i];
+
+        if (info.residual <= tol) break;
+    }
+
+    // Report the true residual rather than the estimate from the Givens rotations.
+    residual(A, b, x, r);
+    info.residual = norm(r) / bnorm;
+    info.converged = info.residual <= tol;
+    return info;
+}
+
+solveInfo CG(const sparseMatrix& A, const std::vector<double>& b, std::vector<double>& x, const preconditioner& M, double tol, int maxIter)
+{
+    size_t n = A.size;
+    solveInfo info;
+    x.resize(n, 0.0);
+
+    double bnorm = norm(b);
+    if (bnorm == 0.0) bnorm = 1.0;
+
+    std::vector<double> r(n), z(n), p(n), q(n);
+    residual(A, b, x, r);
+    info.residual = norm(r) / bnorm;
+    if (info.residual <= tol)
+    {
+        info.converged = true;
+        return info;
+    }
+
+    M.apply(r, z);
+    p = z;
+    double rz = dot(r, z);
+    for (info.iterations = 1; info.iterations <= maxIter; info.iterations++)
+    {
+        A.multiply(p, q);
+        double pq = dot(p, q);
+        if (pq <= 0.0) break; // A is not positive definite
+        double alpha = rz / pq;
+        for (size_t i = 0; i < n; i++)
+        {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+        }
+
+        info.residual = norm(r) / bnorm;
+        if (info.residual <= tol)
+        {
+            info.converged = true;
+            break;
+        }
+
+        M.apply(r, z);
+        double rzNew = dot(r, z);
+        double beta = rzNew / rz;
+        rz = rzNew;
+        for (size_t i = 0; i < n; i++)
+            p[i] = z[i] + beta * p[i];
+    }
+
+    // Report the true residual rather than the recursively updated one.
+    residual(A, b, x, r);
+    info.residual = norm(r) / bnorm;
+    info.iterations = std::min(info.iterations, maxIter);
+    return info;
+}
+
+solveInfo SteadyState(const sparseMatrix& A, std::vector<double>& P, SolverForm form, double tol, int maxIter, KrylovPrecond precond, int refine)
+{
+    if (form == SolverForm::direct)
+        return DirectSteadyState(A, P, luSymbolic(A), tol, refine);
+
+    size_t r = PinnedSite(A);
+    sparseMatrix B;
+    std::vector<double> b;
+    PinnedSystem(A, r, B, b);
+    if (precond == KrylovPrecond::amg)
+    {
+        amgPreconditioner amg(B);
+        return pinnedSteadyState(B, b, r, amg, P, form, tol, maxIter, refine);
+    }
+    jacobiPreconditioner jacobi(B);
+    return pinnedSteadyState(B, b, r, jacobi, P, form, tol, maxIter, refine);
+}
+
+solveInfo SteadyState(const sparseMatrix& A, std::vector<double>& P, SolverForm form, double tol, int maxIter, size_t r, const preconditioner& M, int refine)
+{
+    sparseMatrix B;
+    std::vector<double> b;
+    PinnedSystem(A, r, B, b);
+    return pinnedSteadyState(B, b, r, M, P, form, tol, maxIter, refine);
+}
+
+solveInfo DirectSteadyState(const sparseMatrix& A, std::vector<double>& P, const luSymbolic& symbolic, double tol, int refine)
+{
+    size_t r = PinnedSite(A);
+    sparseMatrix B;
+    std::vector<double> b;
+    PinnedSystem(A, r, B, b);
+
+    solveInfo info;
+    sparseLU lu(symbolic);
+    if (!lu.factor(B))
+    {
+        // A zero pivot: the system is singular (e.g. disconnected), so there is no unique steady state.
+        info.residual = std::numeric_limits<double>::infinity();
+        P.assign(A.size, 1.0 / A.size);
+        return info;
+    }
+
+    std::vector<double> x;
+    lu.solve(b, x);
+    info.refinements = refineSolution(B, b, x, refine, [&](const std::vector<double>& res, std::vector<double>& d) { lu.solve(res, d); });
+    measureSolution(B, b, x, info);
+    info.converged = info.residual <= tol || info.backwardError <= tol;
+
+    double sum = 0.0;
+    for (size_t i = 0; i < x.size(); i++)
+        sum += x[i];
+    P.resize(A.size);
+    for (size_t i = 0; i < x.size(); i++)
+        P[i] = x[i] / sum;
+
+    return info;
+}
+
+void NormaliseSteadyState(std::vector<double>& P)
+{
+    double sum = 0.0;
+    for (size_t i = 0; i < P.size(); i++)
+        sum += P[i];
+    if (sum == 0.0) return;
+    for (size_t i = 0; i < P.size(); i++)
+        P[i] /= sum;
+}
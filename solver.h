@@ -0,0 +1,97 @@
+#pragma once
+#include "pch.h"
+#include "sparse.h"
+#include "direct.h"
+
+// Methods available for finding the steady state of the master equation.
+// svd is the dense singular value decomposition performed in main,
+// arnoldi finds the eigenvalues closest to zero (see SmallestEigenpairs),
+// direct is a sparse LU factorisation (see sparseLU),
+// the others are iterative methods acting on the sparse rate matrix.
+enum class SolverForm { svd, bicgstab, gmres, arnoldi, direct };
+
+// Preconditioners the iterative solvers can apply to the pinned system of a rate matrix.
+// jacobi divides by its diagonal, amg applies an algebraic multigrid V-cycle (see amgPreconditioner).
+enum class KrylovPrecond { jacobi, amg };
+
+// Summary of the outcome of an iterative (or direct) solve.
+struct solveInfo
+{
+	bool converged = false;
+	int iterations = 0;
+
+	// Final residual ||b - A x|| relative to ||b||.
+	double residual = 0.0;
+
+	// Steps of iterative refinement kept (see SteadyState), and the componentwise backward error of the final solution:
+	// the largest over rows of |b - A x|_i / (|A| |x| + |b|)_i, i.e. how well each site's balance of flux holds,
+	// which the normwise residual can't show for sites whose occupation is many orders of magnitude below the largest.
+	// Only set by SteadyState and DirectSteadyState.
+	int refinements = 0;
+	double backwardError = 0.0;
+};
+
+// Interface for preconditioners used by the Krylov solvers.
+// Applying the preconditioner sets z to (an approximation of) A^-1 r.
+class preconditioner
+{
+public:
+	virtual ~preconditioner() {}
+	virtual void apply(const std::vector<double>& r, std::vector<double>& z) const = 0;
+};
+
+// Preconditioner that divides by the diagonal of A.
+class jacobiPreconditioner : public preconditioner
+{
+private:
+	std::vector<double> _rdiag;
+
+public:
+	jacobiPreconditioner(const sparseMatrix& A);
+	void apply(const std::vector<double>& r, std::vector<double>& z) const;
+};
+
+// The site used to fix the normalisation of the steady state: the one with the largest diagonal element.
+size_t PinnedSite(const sparseMatrix& A);
+
+// Construct the non-singular system B x = b whose solution is the steady state of A scaled so that x[r] = 1.
+// Row and column r of A are replaced by those of the identity, and the contribution of column r is moved to b.
+// This is the constraint P[r] = 1 substituted for row r, keeping B as sparse (and as symmetric in structure) as A.
+void PinnedSystem(const sparseMatrix& A, size_t r, sparseMatrix& B, std::vector<double>& b);
+
+// Solve A x = b with the (right preconditioned) stabilised bi-conjugate gradient method.
+// x is used as the initial guess, and is overwritten with the solution.
+solveInfo BiCGSTAB(const sparseMatrix& A, const std::vector<double>& b, std::vector<double>& x, const preconditioner& M, double tol, int maxIter);
+
+// Solve A x = b with the (right preconditioned) generalised minimal residual method, restarted every 'restart' iterations.
+// x is used as the initial guess, and is overwritten with the solution.
+solveInfo GMRES(const sparseMatrix& A, const std::vector<double>& b, std::vector<double>& x, const preconditioner& M, double tol, int maxIter, int restart = 50);
+
+// Solve A x = b, for symmetric positive definite A, with the preconditioned conjugate gradient method.
+// M must also be symmetric positive definite. x is used as the initial guess, and is overwritten with the solution.
+solveInfo CG(const sparseMatrix& A, const std::vector<double>& b, std::vector<double>& x, const preconditioner& M, double tol, int maxIter);
+
+// Find the steady state P of the rate matrix A (A P = 0), normalised so that the elements of P sum to 1.
+// If P already has one element per site it is used as the initial guess.
+// precond only applies to the iterative forms.
+// The solution of the pinned system is then improved by up to refine steps of iterative refinement: the residual is found
+// in compensated (double-double) arithmetic, and the correction solved for in double by the same method, reusing
+// the preconditioner or factorisation. This gives occupations accurate to double precision even where the rates
+// span more orders of magnitude than a double holds, with no need to rescale A. Refinement stops early once the
+// componentwise backward error is at the level of rounding, or stops falling.
+solveInfo SteadyState(const sparseMatrix& A, std::vector<double>& P, SolverForm form, double tol, int maxIter, KrylovPrecond precond = KrylovPrecond::jacobi, int refine = 0);
+
+// As SteadyState with an iterative form, but with the constraint P[r] = 1 and the pinned system preconditioned by M
+// rather than by its diagonal.
+solveInfo SteadyState(const sparseMatrix& A, std::vector<double>& P, SolverForm form, double tol, int maxIter, size_t r, const preconditioner& M, int refine = 0);
+
+// Find the steady state P of A by sparse LU factorisation of its pinned system, normalised so that the elements of P sum to 1.
+// symbolic must have been analysed for the pattern of A, and can be reused for any matrix with that pattern.
+// The residual is that of the pinned system, and the solve counts as converged if it or the backward error is within tol:
+// with occupations spanning many orders of magnitude the normwise residual can be large even though every site balances.
+// refine is as for SteadyState, with each correction from the same LU factors.
+solveInfo DirectSteadyState(const sparseMatrix& A, std::vector<double>& P, const luSymbolic& symbolic, double tol, int refine = 0);
+
+// Scale a null vector P of a rate matrix (a singular vector or eigenvector, with any preconditioning removed) so that its elements
+// sum to 1, as the steady states found by SteadyState and DirectSteadyState do. This also fixes the sign of the vector.
+void NormaliseSteadyState(std::vector<double>& P);
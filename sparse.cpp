@@ -0,0 +1,63 @@
+#include "pch.h"
+#include "sparse.h"
+
+double sparseMatrix::get(size_t i, size_t j) const
+{
+    // Columns within a row are sorted, so use a binary search.
+    std::vector<size_t>::const_iterator first = col.begin() + rowStart[i];
+    std::vector<size_t>::const_iterator last = col.begin() + rowStart[i + 1];
+    std::vector<size_t>::const_iterator it = std::lower_bound(first, last, j);
+
+    if (it != last && *it == j)
+        return val[it - col.begin()];
+    else
+        return 0.0;
+}
+
+void sparseMatrix::scale(double x)
+{
+    for (size_t k = 0; k < val.size(); k++)
+        val[k] *= x;
+}
+
+double sparseMatrix::max() const
+{
+    double m = (nnz() < size * size) ? 0.0 : -std::numeric_limits<double>::infinity();
+    for (size_t k = 0; k < val.size(); k++)
+        if (val[k] > m) m = val[k];
+
+    return m;
+}
+
+double sparseMatrix::min() const
+{
+    double m = (nnz() < size * size) ? 0.0 : std::numeric_limits<double>::infinity();
+    for (size_t k = 0; k < val.size(); k++)
+        if (val[k] < m) m = val[k];
+
+    return m;
+}
+
+void sparseMatrix::multiply(const std::vector<double>& x, std::vector<double>& y) const
+{
+    y.resize(size);
+    for (size_t i = 0; i < size; i++)
+    {
+        double sum = 0.0;
+        for (size_t k = rowStart[i]; k < rowStart[i + 1]; k++)
+            sum += val[k] * x[col[k]];
+        y[i] = sum;
+    }
+}
+
+gsl_matrix* sparseMatrix::toDense() const
+{
+    gsl_matrix* A = gsl_matrix_alloc(size, size);
+    gsl_matrix_set_zero(A);
+
+    for (size_t i = 0; i < size; i++)
+        for (size_t k = rowStart[i]; k < rowStart[i + 1]; k++)
+            gsl_matrix_set(A, i, col[k], val[k]);
+
+    return A;
+}
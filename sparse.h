@@ -0,0 +1,39 @@
+#pragma once
+#include "pch.h"
+
+// A square sparse matrix held in compressed sparse row (CSR) form.
+// Row i occupies the entries [rowStart[i], rowStart[i+1]) of col and val,
+// with the column indices of each row stored in ascending order.
+struct sparseMatrix
+{
+	// Number of rows (and columns).
+	size_t size = 0;
+
+	// Offset of the first entry of each row, plus one past the final entry.
+	std::vector<size_t> rowStart;
+
+	// Column index of each stored entry.
+	std::vector<size_t> col;
+
+	// Value of each stored entry.
+	std::vector<double> val;
+
+	// Number of stored (structurally non-zero) entries.
+	size_t nnz() const { return val.size(); }
+
+	// Get element (i,j). Elements which are not stored are zero.
+	double get(size_t i, size_t j) const;
+
+	// Multiply all stored elements by x.
+	void scale(double x);
+
+	// Largest and smallest element, including any implicit zeros (as gsl_matrix_max / gsl_matrix_min).
+	double max() const;
+	double min() const;
+
+	// y = this * x
+	void multiply(const std::vector<double>& x, std::vector<double>& y) const;
+
+	// Expand to a dense gsl_matrix. The caller is responsible for freeing the result.
+	gsl_matrix* toDense() const;
+};
@@ -0,0 +1,277 @@
+#include "pch.h"
+#include "spectrum.h"
+#include "solver.h"
+#include "gsl/gsl_eigen.h"
+
+namespace
+{
+    double dot(const std::vector<double>& a, const std::vector<double>& b)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < a.size(); i++)
+            sum += a[i] * b[i];
+        return sum;
+    }
+
+    double norm(const std::vector<double>& a)
+    {
+        return std::sqrt(dot(a, a));
+    }
+
+    // Largest absolute row sum of A.
+    double normInf(const sparseMatrix& A)
+    {
+        double largest = 0.0;
+        for (size_t i = 0; i < A.size; i++)
+        {
+            double sum = 0.0;
+            for (size_t k = A.rowStart[i]; k < A.rowStart[i + 1]; k++)
+                sum += std::abs(A.val[k]);
+            largest = std::max(largest, sum);
+        }
+        return largest;
+    }
+
+    // Remove the components of v along the first count (orthonormal) vectors of basis,
+    // adding the removed coefficients to coef if given. Done twice to keep v orthogonal to working precision.
+    void orthogonalise(std::vector<double>& v, const std::vector<std::vector<double>>& basis, size_t count, double* coef = NULL)
+    {
+        for (int pass = 0; pass < 2; pass++)
+            for (size_t b = 0; b < count; b++)
+            {
+                double c = dot(basis[b], v);
+                for (size_t i = 0; i < v.size(); i++)
+                    v[i] -= c * basis[b][i];
+                if (coef) coef[b] += c;
+            }
+    }
+
+    // x = sum over j of V[j] y[j], using the real or imaginary parts of column col of the eigenvectors y.
+    // The arbitrary complex phase of y is first fixed by making its largest element real and positive.
+    void ritzVector(const std::vector<std::vector<double>>& V, const gsl_matrix_complex* y, size_t col, size_t count, bool imag, std::vector<double>& x)
+    {
+        double pr = 1.0, pim = 0.0, largest = -1.0;
+        for (size_t j = 0; j < count; j++)
+        {
+            gsl_complex c = gsl_matrix_complex_get(y, j, col);
+            double modulus = std::hypot(GSL_REAL(c), GSL_IMAG(c));
+            if (modulus > largest)
+            {
+                largest = modulus;
+                pr = GSL_REAL(c) / modulus;
+                pim = -GSL_IMAG(c) / modulus;
+            }
+        }
+
+        std::fill(x.begin(), x.end(), 0.0);
+        for (size_t j = 0; j < count; j++)
+        {
+            gsl_complex c = gsl_matrix_complex_get(y, j, col);
+            double cj = imag ? GSL_REAL(c) * pim + GSL_IMAG(c) * pr : GSL_REAL(c) * pr - GSL_IMAG(c) * pim;
+            for (size_t i = 0; i < x.size(); i++)
+                x[i] += cj * V[j][i];
+        }
+    }
+
+    // Eigenvalues and eigenvectors of the n x n matrix H, with the eigenvalues ordered by decreasing modulus.
+    // H is overwritten.
+    std::vector<size_t> eigenByModulus(gsl_matrix* H, gsl_vector_complex* eval, gsl_matrix_complex* evec)
+    {
+        size_t n = H->size1;
+        gsl_eigen_nonsymmv_workspace* work = gsl_eigen_nonsymmv_alloc(n);
+        gsl_eigen_nonsymmv(H, eval, evec, work);
+        gsl_eigen_nonsymmv_free(work);
+
+        std::vector<size_t> order(n);
+        for (size_t i = 0; i < n; i++)
+            order[i] = i;
+        auto modulus = [&](size_t i) { gsl_complex z = gsl_vector_complex_get(eval, i); return std::hypot(GSL_REAL(z), GSL_IMAG(z)); };
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return modulus(a) > modulus(b); });
+        return order;
+    }
+}
+
+eigenInfo SmallestEigenpairs(const sparseMatrix& A, std::vector<eigenPair>& pairs, const eigenSettings& settings)
+{
+    const size_t n = A.size;
+    const size_t k = std::min(settings.k, n);
+    const size_t m = std::max<size_t>(2, std::min<size_t>(settings.m, n));
+    eigenInfo info;
+    pairs.clear();
+
+    // B = A - shift I
+    sparseMatrix B = A;
+    double largestDiag = 0.0;
+    for (size_t i = 0; i < n; i++)
+        largestDiag = std::max(largestDiag, std::abs(A.get(i, i)));
+    info.shift = settings.shift * largestDiag;
+    for (size_t i = 0; i < n; i++)
+    {
+        size_t d = B.rowStart[i];
+        while (d < B.rowStart[i + 1] && B.col[d] != i) d++;
+        if (d == B.rowStart[i + 1])
+            throw std::logic_error("Shift-invert Arnoldi requires every diagonal element of the rate matrix to be stored.");
+        B.val[d] -= info.shift;
+    }
+    jacobiPreconditioner jacobi(B);
+
+    // Locked, orthonormal basis of the invariant subspace found so far.
+    std::vector<std::vector<double>> Q;
+
+    std::vector<std::vector<double>> V(m + 1, std::vector<double>(n));
+    gsl_matrix* H = gsl_matrix_alloc(m + 1, m);
+    std::vector<double> w(n), x(n);
+
+    // A fixed starting vector, so that results are reproducible.
+    std::vector<double> v0(n);
+    for (size_t i = 0; i < n; i++)
+        v0[i] = 1.0 + 0.5 * std::sin((double)i);
+    double v0norm = norm(v0);
+    for (size_t i = 0; i < n; i++)
+        v0[i] /= v0norm;
+
+    while (Q.size() < k && info.restarts <= settings.maxRestarts)
+    {
+        // Arnoldi process on (A - shift I)^-1, in the complement of the locked subspace.
+        gsl_matrix_set_zero(H);
+        V[0] = v0;
+        size_t mm = m;
+        bool invariant = false;
+        for (size_t j = 0; j < m; j++)
+        {
+            std::fill(w.begin(), w.end(), 0.0);
+            BiCGSTAB(B, V[j], w, jacobi, settings.solverTol, settings.maxIter);
+            info.solves++;
+
+            orthogonalise(w, Q, Q.size());
+            std::vector<double> h(j + 1, 0.0);
+            orthogonalise(w, V, j + 1, h.data());
+            for (size_t i = 0; i <= j; i++)
+                gsl_matrix_set(H, i, j, h[i]);
+
+            double hnext = norm(w);
+            gsl_matrix_set(H, j + 1, j, hnext);
+            if (hnext <= std::numeric_limits<double>::epsilon() * std::abs(gsl_matrix_get(H, j, j)))
+            {
+                // The Krylov subspace is invariant, so its Ritz pairs are exact.
+                mm = j + 1;
+                invariant = true;
+                break;
+            }
+            for (size_t i = 0; i < n; i++)
+                V[j + 1][i] = w[i] / hnext;
+        }
+
+        gsl_matrix* Hm = gsl_matrix_alloc(mm, mm);
+        for (size_t i = 0; i < mm; i++)
+            for (size_t j = 0; j < mm; j++)
+                gsl_matrix_set(Hm, i, j, gsl_matrix_get(H, i, j));
+        gsl_vector_complex* theta = gsl_vector_complex_alloc(mm);
+        gsl_matrix_complex* y = gsl_matrix_complex_alloc(mm, mm);
+        std::vector<size_t> order = eigenByModulus(Hm, theta, y);
+
+        // Lock the leading Ritz vectors while they are converged. The residual of Ritz pair (theta, V y)
+        // is |H(mm, mm-1)| |y[mm-1]|. A complex pair is locked as the real and imaginary parts of its vector.
+        double hlast = invariant ? 0.0 : gsl_matrix_get(H, mm, mm - 1);
+        size_t next = 0;
+        while (next < order.size() && Q.size() < k)
+        {
+            size_t i = order[next];
+            gsl_complex t = gsl_vector_complex_get(theta, i);
+            gsl_complex ylast = gsl_matrix_complex_get(y, mm - 1, i);
+            double modulus = std::hypot(GSL_REAL(t), GSL_IMAG(t));
+            if (hlast * std::hypot(GSL_REAL(ylast), GSL_IMAG(ylast)) > settings.tol * modulus)
+                break;
+
+            bool complex = std::abs(GSL_IMAG(t)) > settings.tol * modulus;
+            for (int part = 0; part < (complex ? 2 : 1); part++)
+            {
+                ritzVector(V, y, i, mm, part == 1, x);
+                orthogonalise(x, Q, Q.size());
+                double xnorm = norm(x);
+                if (xnorm > std::sqrt(settings.tol))
+                {
+                    for (size_t j = 0; j < n; j++)
+                        x[j] /= xnorm;
+                    Q.push_back(x);
+                }
+            }
+            next += complex ? 2 : 1; // Skip the conjugate
+        }
+
+        // Restart from the leading Ritz vector which is not yet locked.
+        if (next < order.size())
+            ritzVector(V, y, order[next], mm, false, v0);
+        orthogonalise(v0, Q, Q.size());
+        v0norm = norm(v0);
+        if (v0norm < std::sqrt(settings.tol))
+        {
+            // Nothing left in the complement; start again from a fresh vector.
+            for (size_t i = 0; i < n; i++)
+                v0[i] = std::cos((double)(i * (Q.size() + 1)));
+            orthogonalise(v0, Q, Q.size());
+            v0norm = norm(v0);
+        }
+        for (size_t i = 0; i < n; i++)
+            v0[i] /= v0norm;
+
+        gsl_matrix_free(Hm);
+        gsl_vector_complex_free(theta);
+        gsl_matrix_complex_free(y);
+        info.restarts++;
+    }
+    gsl_matrix_free(H);
+    info.converged = Q.size() >= k;
+    if (Q.empty())
+        return info;
+
+    // The locked vectors span an invariant subspace of A as well as of the shift-invert operator,
+    // so the eigenpairs of A follow from its projection G = Q^T A Q.
+    size_t q = Q.size();
+    std::vector<std::vector<double>> AQ(q);
+    gsl_matrix* G = gsl_matrix_alloc(q, q);
+    for (size_t j = 0; j < q; j++)
+    {
+        A.multiply(Q[j], AQ[j]);
+        for (size_t i = 0; i < q; i++)
+            gsl_matrix_set(G, i, j, dot(Q[i], AQ[j]));
+    }
+    gsl_vector_complex* lambda = gsl_vector_complex_alloc(q);
+    gsl_matrix_complex* z = gsl_matrix_complex_alloc(q, q);
+    std::vector<size_t> order = eigenByModulus(G, lambda, z);
+
+    double anorm = normInf(A);
+    std::vector<double> xr(n), xi(n), Axr(n), Axi(n);
+    for (size_t o = q; o-- > 0;)
+    {
+        size_t i = order[o];
+        eigenPair pair;
+        pair.re = GSL_REAL(gsl_vector_complex_get(lambda, i));
+        pair.im = GSL_IMAG(gsl_vector_complex_get(lambda, i));
+
+        ritzVector(Q, z, i, q, false, xr);
+        ritzVector(Q, z, i, q, true, xi);
+        A.multiply(xr, Axr);
+        A.multiply(xi, Axi);
+        double res = 0.0, xx = 0.0;
+        for (size_t j = 0; j < n; j++)
+        {
+            double rr = Axr[j] - pair.re * xr[j] + pair.im * xi[j];
+            double ri = Axi[j] - pair.re * xi[j] - pair.im * xr[j];
+            res += rr * rr + ri * ri;
+            xx += xr[j] * xr[j] + xi[j] * xi[j];
+        }
+        pair.residual = (anorm > 0.0) ? std::sqrt(res / xx) / anorm : 0.0;
+
+        double xrnorm = norm(xr);
+        for (size_t j = 0; j < n; j++)
+            xr[j] /= xrnorm;
+        pair.vec = xr;
+        pairs.push_back(pair);
+    }
+
+    gsl_matrix_free(G);
+    gsl_vector_complex_free(lambda);
+    gsl_matrix_complex_free(z);
+    return info;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "pch.h"
+#include "sparse.h"
+
+// An eigenvalue lambda of a rate matrix, with the real part of its eigenvector.
+struct eigenPair
+{
+	double re = 0.0;
+	double im = 0.0;
+	std::vector<double> vec; // Unit 2-norm
+
+	// ||A x - lambda x|| / (||A|| ||x||)
+	double residual = 0.0;
+};
+
+// Summary of the outcome of an eigenvalue computation.
+struct eigenInfo
+{
+	bool converged = false;
+	int restarts = 0;
+
+	// Number of linear solves with A - shift I, i.e. applications of the shift-invert operator.
+	int solves = 0;
+
+	// Shift used, in the units of A.
+	double shift = 0.0;
+};
+
+// Settings for SmallestEigenpairs.
+struct eigenSettings
+{
+	size_t k = 4; // Number of eigenpairs wanted
+	int m = 20; // Dimension of the Krylov subspace built between restarts
+	int maxRestarts = 100;
+
+	// Ritz pairs are accepted when their estimated residual is below tol, relative to the Ritz value of the operator.
+	double tol = 1e-8;
+
+	// Shift, relative to the largest diagonal element of A. Smaller shifts separate the eigenvalues
+	// closest to zero more strongly, but make the linear solves harder.
+	double shift = 1e-6;
+
+	// Tolerance and iteration limit of each BiCGSTAB solve with A - shift I.
+	double solverTol = 1e-12;
+	int maxIter = 10000;
+};
+
+// Find the k eigenvalues of the rate matrix A closest to zero, and their eigenvectors, without a dense decomposition.
+// Arnoldi iteration is applied to the shift-invert operator (A - shift I)^-1, whose largest eigenvalues 1/(lambda - shift)
+// belong to the eigenvalues of A nearest zero. All eigenvalues of a rate matrix have non-positive real part,
+// so any positive shift is not an eigenvalue and A - shift I is nonsingular. The closer the shift is to zero (and so to the
+// eigenvalues sought), the worse conditioned the solves become.
+// The Krylov subspace is restarted from the leading unconverged Ritz vector, and converged Ritz vectors are locked:
+// later subspaces are kept orthogonal to them, so repeated eigenvalues (e.g. several zero eigenvalues from disconnected
+// clusters of sites) are all found. Eigenpairs are returned in order of increasing |lambda|.
+eigenInfo SmallestEigenpairs(const sparseMatrix& A, std::vector<eigenPair>& pairs, const eigenSettings& settings);
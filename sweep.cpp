@@ -0,0 +1,226 @@
+#include "pch.h"
+#include "sweep.h"
+#include "consts.h"
+#include "parallel.h"
+
+namespace
+{
+    // Start a stage of the sweep, if it's profiled.
+    std::unique_ptr<sweepStage> startStage(const sweepSettings& settings, const char* name)
+    {
+        return settings.stage ? settings.stage(name) : nullptr;
+    }
+
+    void setSolveMetrics(sweepStage& stage, const solveInfo& info)
+    {
+        stage.Set("iterations", info.iterations);
+        stage.Set("residual", info.residual);
+        stage.Set("refinements", info.refinements);
+        stage.Set("backwardError", info.backwardError);
+        stage.Set("converged", info.converged);
+    }
+}
+
+std::vector<sweepPoint> SweepPoints(const std::vector<double>& fields, const std::vector<double>& temps, const std::vector<double>& reorgs)
+{
+    std::vector<sweepPoint> points;
+    points.reserve(fields.size() * temps.size() * reorgs.size());
+    for (size_t r = 0; r < reorgs.size(); r++)
+        for (size_t t = 0; t < temps.size(); t++)
+            for (size_t f = 0; f < fields.size(); f++)
+                points.push_back({ fields[f], temps[t], reorgs[r] });
+
+    return points;
+}
+
+std::vector<sweepResult> RunSweep(const std::vector<site>& sites, const siteGraph& graph, const std::vector<sweepPoint>& points, const sweepSettings& settings)
+{
+    std::vector<sweepResult> results(points.size());
+
+    // Group points which differ only in field. Points are generated with field varying fastest,
+    // but don't rely on that: collect each group in the order the points were given.
+    std::vector<std::vector<size_t>> groups;
+    for (size_t p = 0; p < points.size(); p++)
+    {
+        size_t g = 0;
+        for (; g < groups.size(); g++)
+            if (points[groups[g][0]].temp == points[p].temp && points[groups[g][0]].reorg == points[p].reorg)
+                break;
+        if (g == groups.size()) groups.push_back(std::vector<size_t>());
+        groups[g].push_back(p);
+    }
+
+    // Split each group into consecutive runs of at most sweepRunLength points, so that a single long field sweep
+    // still uses every thread. The split doesn't depend on the number of threads, so neither do the initial guesses
+    // and hence the results.
+    std::vector<std::vector<size_t>> runs;
+    std::vector<size_t> runGroup;
+    for (size_t g = 0; g < groups.size(); g++)
+        for (size_t begin = 0; begin < groups[g].size(); begin += sweepRunLength)
+        {
+            runs.push_back(std::vector<size_t>(groups[g].begin() + begin, groups[g].begin() + std::min(begin + sweepRunLength, groups[g].size())));
+            runGroup.push_back(g);
+        }
+
+    // The near equilibrium preconditioner replaces conditioning of the rate matrix.
+    const bool nearEquilibrium = settings.balance != BalanceForm::off && settings.solver != SolverForm::direct;
+    const transporter::PrecondForm form = nearEquilibrium ? transporter::PrecondForm::off : settings.form;
+
+    // Every point has the same rate matrix pattern, so the direct solver and preconditioner need only one symbolic factorisation.
+    std::unique_ptr<luSymbolic> symbolic;
+    if ((settings.solver == SolverForm::direct || nearEquilibrium) && !points.empty())
+    {
+        std::unique_ptr<sweepStage> stage = startStage(settings, "analysis");
+        transporter transport(sites, graph, kB * points[0].temp, settings.fieldX, settings.fieldY, points[0].fieldZ, points[0].reorg, settings.transE, settings.logDomain);
+        symbolic.reset(new luSymbolic(transport.CreateSparseRateMatrix(form, false, false), settings.solver == SolverForm::direct || settings.balance == BalanceForm::exact));
+        if (stage) stage->Set("factorNnz", settings.solver == SolverForm::direct ? symbolic->nnzFactors() : symbolic->nnzSymmetricFactors());
+    }
+
+    // The rate matrix at zero field, which satisfies detailed balance, differs between groups only in temperature and reorganisation energy.
+    std::vector<std::unique_ptr<detailedBalancePreconditioner>> balance(groups.size());
+    if (nearEquilibrium)
+        ParallelFor(groups.size(), [&](size_t g)
+        {
+            std::unique_ptr<sweepStage> stage = startStage(settings, "factorisation");
+            const sweepPoint& first = points[groups[g][0]];
+            transporter transport(sites, graph, kB * first.temp, 0.0, first.reorg, settings.transE, settings.logDomain);
+            std::vector<double> logPi(sites.size());
+            for (size_t s = 0; s < sites.size(); s++)
+                logPi[s] = transport.LogBoltzmannFactor(s);
+            balance[g].reset(new detailedBalancePreconditioner(transport.CreateSparseRateMatrix(transporter::PrecondForm::off, false, false), logPi, *symbolic));
+            if (stage)
+            {
+                stage->Set("group", g);
+                stage->Set("factored", balance[g]->Factored());
+            }
+        });
+
+    // A group whose zero field rate matrix is singular is solved without the preconditioner (on the unconditioned rate matrix).
+    for (size_t g = 0; g < balance.size(); g++)
+        if (balance[g] && !balance[g]->Factored())
+        {
+            const sweepPoint& first = points[groups[g][0]];
+            std::cout << "***WARNING***: Zero field rate matrix at temp " << first.temp << " K, reorg " << first.reorg
+                << " eV is singular. Solving without near equilibrium preconditioning.\n";
+            balance[g].reset();
+        }
+
+    ParallelFor(runs.size(), [&](size_t r)
+    {
+        const sweepPoint& first = points[runs[r][0]];
+        std::unique_ptr<sweepStage> stage = startStage(settings, "assembly");
+        transporter transport(sites, graph, kB * first.temp, settings.fieldX, settings.fieldY, first.fieldZ, first.reorg, settings.transE, settings.logDomain);
+        sparseMatrix A = transport.CreateSparseRateMatrix(form, false, false);
+        const detailedBalancePreconditioner* M = balance[runGroup[r]].get();
+
+        // Conditioned solution, carried between points as the initial guess.
+        std::vector<double> Pcond;
+        for (size_t k = 0; k < runs[r].size(); k++)
+        {
+            size_t p = runs[r][k];
+            if (k > 0)
+            {
+                stage = startStage(settings, "assembly");
+                transport.SetFieldZ(points[p].fieldZ);
+                transport.UpdateSparseRateMatrix(A, form);
+            }
+            if (stage)
+            {
+                stage->Set("point", p);
+                stage->Set("nnz", A.nnz());
+            }
+
+            stage.reset();
+            stage = startStage(settings, "solve");
+            if (M)
+                results[p].info = SteadyState(A, Pcond, settings.solver, settings.tol, settings.maxIter, M->Pinned(), *M, settings.refine);
+            else if (settings.solver == SolverForm::direct)
+                results[p].info = DirectSteadyState(A, Pcond, *symbolic, settings.tol, settings.refine);
+            else
+                results[p].info = SteadyState(A, Pcond, settings.solver, settings.tol, settings.maxIter, settings.precond, settings.refine);
+
+            std::vector<double> P = Pcond;
+            transport.RemovePreconditioning(P, form);
+
+            transport.Velocity(P, results[p].velocity_x, results[p].velocity_y, results[p].velocity_z);
+            if (stage)
+            {
+                stage->Set("point", p);
+                setSolveMetrics(*stage, results[p].info);
+            }
+            stage.reset();
+        }
+    });
+
+    return results;
+}
+
+void printSweep(const std::vector<sweepPoint>& points, const std::vector<sweepResult>& results, const sweepSettings& settings)
+{
+    const bool showX = settings.fieldX != 0.0, showY = settings.fieldY != 0.0;
+
+    std::stringstream sstream;
+    sstream << std::setw(14) << std::left << "fieldZ"
+        << std::setw(10) << std::left << "temp"
+        << std::setw(10) << std::left << "reorg"
+        << std::setw(8) << std::left << "iter"
+        << std::setw(14) << std::left << "residual";
+    if (showX) sstream << std::setw(16) << std::left << "velocity_x";
+    if (showY) sstream << std::setw(16) << std::left << "velocity_y";
+    sstream << std::setw(16) << std::left << "velocity_z"
+        << std::setw(16) << std::left << "mobility" << "\n";
+    sstream << std::setw(14) << std::left << "(V/Ang)"
+        << std::setw(10) << std::left << "(K)"
+        << std::setw(10) << std::left << "(eV)"
+        << std::setw(8) << std::left << ""
+        << std::setw(14) << std::left << "";
+    if (showX) sstream << std::setw(16) << std::left << "(Ang/s)";
+    if (showY) sstream << std::setw(16) << std::left << "(Ang/s)";
+    sstream << std::setw(16) << std::left << "(Ang/s)"
+        << std::setw(16) << std::left << "(cm^2/V*s)" << "\n";
+
+    for (size_t p = 0; p < points.size(); p++)
+    {
+        sstream << std::setw(14) << std::left << points[p].fieldZ
+            << std::setw(10) << std::left << points[p].temp
+            << std::setw(10) << std::left << points[p].reorg
+            << std::setw(8) << std::left << results[p].info.iterations;
+
+        std::stringstream num;
+        num.setf(std::ios::scientific);
+        num.precision(3);
+        num << results[p].info.residual;
+        sstream << std::setw(14) << std::left << num.str();
+
+        num.precision(6);
+        if (showX)
+        {
+            num.str("");
+            num << results[p].velocity_x;
+            sstream << std::setw(16) << std::left << num.str();
+        }
+        if (showY)
+        {
+            num.str("");
+            num << results[p].velocity_y;
+            sstream << std::setw(16) << std::left << num.str();
+        }
+        num.str("");
+        num << results[p].velocity_z;
+        sstream << std::setw(16) << std::left << num.str();
+
+        // Mobility along the field: the velocity projected onto it, over its strength.
+        num.str("");
+        const double F2 = settings.fieldX * settings.fieldX + settings.fieldY * settings.fieldY + points[p].fieldZ * points[p].fieldZ;
+        if (F2 != 0.0)
+            num << (results[p].velocity_x * settings.fieldX + results[p].velocity_y * settings.fieldY + results[p].velocity_z * points[p].fieldZ) / F2 * 1e-16;
+        else
+            num << "-";
+        sstream << std::setw(16) << std::left << num.str();
+
+        if (!results[p].info.converged) sstream << "(not converged)";
+        sstream << "\n";
+    }
+
+    std::cout << sstream.str();
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include "pch.h"
+#include "site.h"
+#include "graph.h"
+#include "transporter.h"
+#include "solver.h"
+#include "balance.h"
+
+// One combination of the simulation parameters which may be swept.
+struct sweepPoint
+{
+	double fieldZ; // V/Ang
+	double temp; // K
+	double reorg; // eV
+};
+
+// A stage of a sweep (analysis, factorisation, assembly or solve), timed from its creation until it is destroyed, for profiling.
+// The library can't depend on the profiler (profile.h), so a program that profiles derives from this, e.g. wrapping a profileStage.
+class sweepStage
+{
+public:
+	virtual ~sweepStage() {}
+
+	// Attach a metric to the stage, as profileStage::Set.
+	virtual void Set(const std::string& key, double value) = 0;
+};
+
+// The parameters that stay fixed across a sweep.
+struct sweepSettings
+{
+	double transE = 0.0;
+
+	// Components of the field in x and y (V/Ang), with fieldZ of each point.
+	double fieldX = 0.0;
+	double fieldY = 0.0;
+
+	transporter::PrecondForm form = transporter::PrecondForm::off;
+	SolverForm solver = SolverForm::bicgstab;
+	KrylovPrecond precond = KrylovPrecond::jacobi;
+	double tol = 1e-10;
+	int maxIter = 10000;
+
+	// Precondition the iterative solver with the zero field rate matrix (see detailedBalancePreconditioner),
+	// instead of conditioning the rate matrix by form.
+	BalanceForm balance = BalanceForm::off;
+
+	// Steps of iterative refinement for each solve (see SteadyState), and whether the transporters keep log domain rates.
+	int refine = 0;
+	bool logDomain = false;
+
+	// If set, starts a stage for the shared symbolic analysis, the factorisation of each group's preconditioner, and the
+	// assembly and solve of each point. Called from the thread running the stage, so must be thread safe. Stages on
+	// different threads overlap, so only their wall times are their own: CPU time and allocations are those of the process.
+	std::unique_ptr<sweepStage> (*stage)(const char* name) = nullptr;
+};
+
+// The outcome of solving at a single sweep point.
+struct sweepResult
+{
+	solveInfo info;
+	double velocity_x = 0.0, velocity_y = 0.0, velocity_z = 0.0; // Ang/s
+};
+
+// Largest number of points solved in sequence by one transporter in RunSweep.
+const size_t sweepRunLength = 4;
+
+// Every combination of the listed fields, temperatures and reorganisation energies.
+std::vector<sweepPoint> SweepPoints(const std::vector<double>& fields, const std::vector<double>& temps, const std::vector<double>& reorgs);
+
+// Find the steady state velocity at each sweep point, sharing the sites and graph between all points.
+// Points with the same temperature and reorganisation energy are solved in sequence by one transporter,
+// changing only the field: rates and rate matrix are updated in place, and each solve starts from the previous solution.
+// These runs, of at most sweepRunLength points, are split between threads.
+// With the direct solver the symbolic factorisation is done once and shared by every point.
+// With settings.balance each group factorises its zero field rate matrix once, shared by its runs.
+// Each stage started by settings.stage is given the point (index into points) or group it belongs to, and the
+// non-zero elements of the rate matrix or factors, or the iterations and residual of the solve.
+std::vector<sweepResult> RunSweep(const std::vector<site>& sites, const siteGraph& graph, const std::vector<sweepPoint>& points, const sweepSettings& settings);
+
+// Print one line per sweep point with the velocity and the mobility along the field, v.F / |F|^2.
+// The field is (settings.fieldX, settings.fieldY, fieldZ of the point), and velocity_x or velocity_y are printed if it has that component.
+void printSweep(const std::vector<sweepPoint>& points, const std::vector<sweepResult>& results, const sweepSettings& settings);
@@ -0,0 +1,260 @@
+#include "pch.h"
+#include "transient.h"
+#include "solver.h"
+
+namespace
+{
+    // Fixed size header at the start of a checkpoint file, followed by the M occupation probabilities.
+    struct checkpointHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint64_t numSites;
+        double t;
+        double h;
+        double interval;
+        double fingerprint;
+        uint64_t steps;
+        uint64_t rejected;
+        uint64_t records;
+        uint64_t fileOffset; // Length of the output file when the checkpoint was written
+        uint64_t reserved[4];
+    };
+
+    const char checkpointMagic[8] = { 'M', 'E', 'S', 'C', 'H', 'K', 'P', 'T' };
+    const uint32_t checkpointByteOrder = 0x01020304;
+
+    double norm1(const std::vector<double>& a)
+    {
+        double sum = 0.0;
+        for (size_t i = 0; i < a.size(); i++)
+            sum += std::abs(a[i]);
+        return sum;
+    }
+
+    // Sum of the magnitudes of the elements of A.
+    // Stored in checkpoints to catch an attempt to resume with a different rate matrix.
+    double fingerprint(const sparseMatrix& A)
+    {
+        double sum = 0.0;
+        for (size_t k = 0; k < A.nnz(); k++)
+            sum += std::abs(A.val[k]);
+        return sum;
+    }
+
+    // B = I - c A, reusing the sparsity pattern of A. diag[i] is the position of element (i,i) in A.
+    void shiftedMatrix(const sparseMatrix& A, double c, const std::vector<size_t>& diag, sparseMatrix& B)
+    {
+        B.size = A.size;
+        B.rowStart = A.rowStart;
+        B.col = A.col;
+        B.val.resize(A.nnz());
+        for (size_t k = 0; k < A.nnz(); k++)
+            B.val[k] = -c * A.val[k];
+        for (size_t i = 0; i < A.size; i++)
+            B.val[diag[i]] += 1.0;
+    }
+
+    void writeRecord(std::ofstream& out, double t, double v_z, const std::vector<double>& P, const std::vector<size_t>& outputIndex)
+    {
+        out << t << " " << v_z;
+        for (size_t j = 0; j < P.size(); j++)
+            out << " " << P[outputIndex.empty() ? j : outputIndex[j]];
+        out << "\n";
+    }
+
+    // Write to a temporary file and then replace the checkpoint, so an interruption never leaves a partial checkpoint.
+    void writeCheckpoint(const std::string& filename, const checkpointHeader& header, const std::vector<double>& P)
+    {
+        std::string tmp = filename + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            out.write((const char*)&header, sizeof(header));
+            out.write((const char*)P.data(), P.size() * sizeof(double));
+            if (!out) {
+                std::cout << "***ERROR***: Failed writing " << tmp << std::endl;
+                exit(-1);
+            }
+        }
+        std::filesystem::rename(tmp, filename);
+    }
+
+    void readCheckpoint(const std::string& filename, checkpointHeader& header, std::vector<double>& P)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in) {
+            std::cout << "***ERROR***: Unable to open checkpoint " << filename << std::endl;
+            exit(-1);
+        }
+
+        in.read((char*)&header, sizeof(header));
+        if (!in || memcmp(header.magic, checkpointMagic, sizeof(checkpointMagic)) != 0)
+        {
+            std::cout << "***ERROR***: " << filename << " is not a checkpoint file.\n";
+            exit(-1);
+        }
+        if (header.byteOrder != checkpointByteOrder || header.version != checkpointVersion)
+        {
+            std::cout << "***ERROR***: Checkpoint has version " << header.version << " or byte order unsupported by this build (expected version " << checkpointVersion << ").\n";
+            exit(-1);
+        }
+
+        P.resize(header.numSites);
+        in.read((char*)P.data(), P.size() * sizeof(double));
+        if (!in) {
+            std::cout << "***ERROR***: Checkpoint " << filename << " is truncated.\n";
+            exit(-1);
+        }
+    }
+}
+
+transientInfo RunTransient(transporter& transport, const sparseMatrix& A, std::vector<double>& P, const transientSettings& settings)
+{
+    const size_t M = A.size;
+
+    // TR-BDF2 with gamma = 2 - sqrt(2): a trapezoidal step to t + gamma h then BDF2 to t + h,
+    // for which both stages have the matrix I - (gamma h / 2) A.
+    const double gamma = 2.0 - std::sqrt(2.0);
+    const double w1 = 1.0 / (gamma * (2.0 - gamma));
+    const double w0 = -(1.0 - gamma) * (1.0 - gamma) / (gamma * (2.0 - gamma));
+
+    // Local error constant: the error of a step is C h^3 P''', with P''' estimated from A P at the three stage times.
+    const double C = (-3.0 * gamma * gamma + 4.0 * gamma - 2.0) / (12.0 * (2.0 - gamma));
+
+    std::vector<size_t> diag(M);
+    double fastest = 0.0;
+    for (size_t i = 0; i < M; i++)
+    {
+        for (size_t k = A.rowStart[i]; k < A.rowStart[i + 1]; k++)
+            if (A.col[k] == i) diag[i] = k;
+        fastest = std::max(fastest, std::abs(A.val[diag[i]]));
+    }
+
+    const std::string checkpoint = settings.file + ".chk";
+    transientInfo info;
+    checkpointHeader header = {};
+    memcpy(header.magic, checkpointMagic, sizeof(checkpointMagic));
+    header.version = checkpointVersion;
+    header.byteOrder = checkpointByteOrder;
+    header.numSites = M;
+    header.interval = settings.interval;
+    header.fingerprint = fingerprint(A);
+
+    // Start with a step on the timescale of the fastest escape rate, and let the error control lengthen it.
+    double h = (fastest > 0.0) ? 1.0 / fastest : settings.interval;
+
+    std::ofstream out;
+    if (settings.resume)
+    {
+        std::vector<double> Pc;
+        checkpointHeader saved;
+        readCheckpoint(checkpoint, saved, Pc);
+        if (saved.numSites != M || saved.interval != settings.interval || saved.fingerprint != header.fingerprint)
+        {
+            std::cout << "***ERROR***: Checkpoint " << checkpoint << " was written for a different system, rate matrix or output interval.\n";
+            exit(-1);
+        }
+        P = Pc;
+        info.t = saved.t;
+        info.steps = (int)saved.steps;
+        info.rejected = (int)saved.rejected;
+        info.records = (int)saved.records;
+        h = saved.h;
+
+        // Discard any records written after the checkpoint, which will be written again.
+        std::filesystem::resize_file(settings.file, saved.fileOffset);
+        out.open(settings.file, std::ios::app);
+    }
+    else
+        out.open(settings.file, std::ios::trunc);
+    if (!out) {
+        std::cout << "***ERROR***: Unable to open " << settings.file << std::endl;
+        exit(-1);
+    }
+    out.setf(std::ios::scientific);
+    out.precision(10);
+
+    auto record = [&]()
+    {
+        if (info.records == 0)
+            out << "# t(s) velocity_z(Ang/s) P_0 ... P_" << M - 1 << "\n";
+        writeRecord(out, info.t, transport.velocity_z(P), P, settings.outputIndex);
+        out.flush();
+        info.records++;
+
+        header.t = info.t;
+        header.h = h;
+        header.steps = info.steps;
+        header.rejected = info.rejected;
+        header.records = info.records;
+        header.fileOffset = (uint64_t)out.tellp();
+        writeCheckpoint(checkpoint, header, P);
+    };
+
+    if (info.records == 0)
+        record();
+
+    sparseMatrix B;
+    std::vector<double> fn(M), fg(M), f1(M), rhs(M), Pg(M), P1(M);
+    while (info.t < settings.tEnd)
+    {
+        double tNext = std::min(info.records * settings.interval, settings.tEnd);
+        bool clipped = h >= tNext - info.t;
+        double hStep = clipped ? tNext - info.t : h;
+        if (hStep <= std::numeric_limits<double>::epsilon() * info.t)
+        {
+            std::cout << "***WARNING***: Transient step size underflow at t = " << info.t << " s.\n";
+            return info;
+        }
+
+        shiftedMatrix(A, 0.5 * gamma * hStep, diag, B);
+        jacobiPreconditioner jacobi(B);
+
+        // Trapezoidal stage: (I - gamma h/2 A) Pg = (I + gamma h/2 A) P
+        A.multiply(P, fn);
+        for (size_t i = 0; i < M; i++)
+            rhs[i] = P[i] + 0.5 * gamma * hStep * fn[i];
+        Pg = P;
+        solveInfo sg = BiCGSTAB(B, rhs, Pg, jacobi, settings.solverTol, settings.maxIter);
+
+        // BDF2 stage: (I - gamma h/2 A) P1 = w1 Pg + w0 P
+        for (size_t i = 0; i < M; i++)
+            rhs[i] = w1 * Pg[i] + w0 * P[i];
+        P1 = Pg;
+        solveInfo s1 = BiCGSTAB(B, rhs, P1, jacobi, settings.solverTol, settings.maxIter);
+
+        double err = std::numeric_limits<double>::infinity();
+        if (sg.converged && s1.converged)
+        {
+            A.multiply(Pg, fg);
+            A.multiply(P1, f1);
+            double sum = 0.0;
+            for (size_t i = 0; i < M; i++)
+                sum += std::abs(2.0 * C * hStep * (fn[i] / gamma - fg[i] / (gamma * (1.0 - gamma)) + f1[i] / (1.0 - gamma)));
+            err = sum / (settings.tol * norm1(P));
+        }
+
+        // Standard step size controller for a method with local error O(h^3).
+        double factor = (err > 0.0) ? std::min(5.0, std::max(0.2, 0.9 * std::pow(err, -1.0 / 3.0))) : 5.0;
+        if (err > 1.0)
+        {
+            h = hStep * factor;
+            info.rejected++;
+            continue;
+        }
+
+        info.t = clipped ? tNext : info.t + hStep;
+        info.steps++;
+        P.swap(P1);
+
+        // A step shortened to land on a record time says nothing about the step the error allows.
+        h = clipped ? std::max(h, hStep * factor) : hStep * factor;
+
+        if (clipped)
+            record();
+    }
+
+    info.completed = true;
+    return info;
+}
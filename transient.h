@@ -0,0 +1,52 @@
+#pragma once
+#include "pch.h"
+#include "sparse.h"
+#include "transporter.h"
+
+// Settings for integrating the time dependent master equation.
+struct transientSettings
+{
+	double tEnd = 0.0; // s
+	double interval = 0.0; // s, time between records written to the output file
+
+	// Allowed local error of each step, relative to the total occupation probability.
+	double tol = 1e-6;
+
+	// Tolerance and iteration limit of the linear solve at each stage.
+	double solverTol = 1e-10;
+	int maxIter = 10000;
+
+	// Records are written to file, and a checkpoint to file + ".chk" after each record.
+	std::string file = "transient.dat";
+
+	// If not empty, column j of each record is P[outputIndex[j]], e.g. to write sites in the order of the input files.
+	std::vector<size_t> outputIndex;
+
+	// Continue from the checkpoint of an earlier run rather than from the initial occupation probabilities.
+	bool resume = false;
+};
+
+// Summary of the outcome of a transient integration.
+struct transientInfo
+{
+	bool completed = false;
+	double t = 0.0; // s, time reached
+
+	// Number of accepted steps, and of steps rejected and retried with a shorter step.
+	int steps = 0;
+	int rejected = 0;
+
+	int records = 0;
+};
+
+// Current version of the checkpoint file format, stored in the header.
+const uint32_t checkpointVersion = 1;
+
+// Integrate dP/dt = A P from t = 0 to settings.tEnd, where A is the (unpreconditioned) sparse rate matrix of transport.
+// Uses TR-BDF2, an L-stable implicit Runge-Kutta method, so steps aren't limited by the fastest rates.
+// Both stages solve with the same matrix I - (gamma h / 2) A, by BiCGSTAB. The step length is adapted
+// to keep an embedded estimate of the local error within settings.tol.
+// At every multiple of settings.interval a record "t velocity_z P_0 ... P_M-1" is appended to settings.file,
+// then a checkpoint is written so that an interrupted run can be resumed. Only the current P is held in memory.
+// P holds the initial occupation probabilities, and is overwritten with P(t) at the time reached.
+transientInfo RunTransient(transporter& transport, const sparseMatrix& A, std::vector<double>& P, const transientSettings& settings);
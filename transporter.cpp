@@ -3,67 +3,145 @@
 #include "transporter.h"
 #include "consts.h"
 #include "utility.h"
+#include "marcus.h"
+#include "parallel.h"
 
 
 // Construct a transporter object
-transporter::transporter(double kBT, double fieldZ, double reorg, double transE, bool periodic, double sizeZ) : 
+transporter::transporter(const std::vector<site>& sites, const siteGraph& graph, double kBT, double fieldZ, double reorg, double transE, bool logDomain) :
+    transporter(sites, graph, kBT, 0.0, 0.0, fieldZ, reorg, transE, logDomain)
+{
+}
+
+transporter::transporter(const std::vector<site>& sites, const siteGraph& graph, double kBT, double fieldX, double fieldY, double fieldZ,
+    double reorg, double transE, bool logDomain) :
+    _sites(sites),
+    _graph(graph),
 	_kBT(kBT),
+	_fieldX(fieldX),
+	_fieldY(fieldY),
 	_fieldZ(fieldZ),
 	_reorg(reorg),
     _transE(transE),
-	_periodic(periodic),
-	_sizeZ(sizeZ),
-	_rsizeZ(1.0 / sizeZ)
-{}
+    _prefactor(((2 * pi) / hbar) * std::pow(4 * pi * reorg * kBT, -0.5)),
+    _rdenom(1.0 / (4 * reorg * kBT)),
+    _rate(graph.numEdges()),
+    _logDomain(logDomain),
+    _logRate(logDomain ? graph.numEdges() : 0)
+{
+    if (graph.deltaZ.size() != graph.numEdges())
+        throw std::logic_error("Site graph geometry must be set before constructing a transporter.");
+
+    SetField(fieldX, fieldY, fieldZ);
+}
 
-// Calculate the energetic driving force for the transfer of a charge from this site (as initial) to the site passed as pointer (as final).
-// If periodic is true then use the minimum image convention to find the shortest path to from this site to the target site.
-double transporter::deltaE(site* orig, site* dest)
+// Change the field, and re-evaluate the rate along every edge in a single pass over the graph.
+void transporter::SetField(double fieldX, double fieldY, double fieldZ)
 {
-	double deltaZ = (dest->pos.Z - orig->pos.Z);
+    _fieldX = fieldX;
+    _fieldY = fieldY;
+    _fieldZ = fieldZ;
 
-	// If periodic boundaries in z, then apply the minimum image convention.
-	if (_periodic) deltaZ -= _sizeZ * floor(deltaZ * _rsizeZ + 0.5);
+    // The kernels take one displacement per edge and one field component. With a field along z alone these are deltaZ and fieldZ,
+    // otherwise the energy change of each edge is formed here, and passed with a unit field.
+    const double* displacement = _graph.deltaZ.data();
+    double field = _fieldZ;
+    if (_fieldX != 0.0 || _fieldY != 0.0)
+    {
+        _fieldEnergy.resize(_rate.size());
+        ParallelFor(_rate.size(), [&](size_t e)
+        {
+            _fieldEnergy[e] = _graph.deltaX[e] * _fieldX + _graph.deltaY[e] * _fieldY + _graph.deltaZ[e] * _fieldZ;
+        });
+        displacement = _fieldEnergy.data();
+        field = 1.0;
+    }
+    else
+        std::vector<double>().swap(_fieldEnergy);
 
-	return (dest->energy - orig->energy) + deltaZ * _fieldZ;
+    if (_logDomain)
+    {
+        MarcusLogRates(_rate.size(), _graph.J2.data(), _graph.dE0.data(), displacement, field, _reorg, std::log(_prefactor), _rdenom, _logRate.data());
+        ParallelFor(_rate.size(), [&](size_t e) { _rate[e] = std::exp(_logRate[e]); });
+        return;
+    }
+    MarcusRates(_rate.size(), _graph.J2.data(), _graph.dE0.data(), displacement, field, _reorg, _prefactor, _rdenom, _rate.data());
+}
+
+void transporter::SetFieldZ(double fieldZ)
+{
+    SetField(_fieldX, _fieldY, fieldZ);
+}
+
+double transporter::CheckRates()
+{
+    if (!_fieldEnergy.empty())
+        return CheckMarcusRates(_rate.size(), _graph.J2.data(), _graph.dE0.data(), _fieldEnergy.data(), 1.0, _reorg, _kBT);
+    return CheckMarcusRates(_rate.size(), _graph.J2.data(), _graph.dE0.data(), _graph.deltaZ.data(), _fieldZ, _reorg, _kBT);
+}
 
+// Calculate the energetic driving force for the transfer of a charge along edge e of the site graph.
+// The displacement along the edge follows the minimum image convention if the graph is periodic.
+double transporter::deltaE(size_t e)
+{
+	if (!_fieldEnergy.empty())
+		return _graph.dE0[e] + _fieldEnergy[e];
+	return _graph.dE0[e] + _graph.deltaZ[e] * _fieldZ;
 }
 
 // Calculate the transfer rate between two sites.
 // If the passed sites are not interacting, the rate will be zero.
-// Only performs the full calculation the first time this function is called (for this this specific rate).
-double transporter::Rate(site* orig, site* dest)
+double transporter::Rate(size_t orig, size_t dest)
 {
-    site::neighbour* pN = orig->hasNeighbour(dest);
+    size_t e = _graph.edge(orig, dest);
 
-    if (!pN)
+    if (e == siteGraph::none)
         // Sites aren't interacting, transfer rate will be zero.
         return 0.0;
-    else if (pN->_rate < 0.0) // If rate is -1, then this is the initial call and rate needs to be calculated. Using '<' to avoid equality comparison on floating point values.
-    {
-        double J2 = std::pow(pN->_J, 2); // |J_if|^2
-        pN->_rate = ((2 * pi) / hbar) * J2 * std::pow(4 * pi * _reorg * _kBT, -0.5) * std::exp(-1 * std::pow(deltaE(orig,dest) + _reorg, 2) / (4 * _reorg * _kBT));
-        return pN->_rate;
-    }
-    else // Rate has already been calculated. Just grab it.
-        return pN->_rate;
-
+    else
+        return Rate(e);
 }
 
 // Calculate the sum of all transfer rates into the specified site.
-double transporter::RateSum(site* dest)
+double transporter::RateSum(size_t dest)
 {
     double sum = 0;
-    std::vector<site::neighbour*>::iterator it = dest->neighbours.begin();
-    for (int i = 0; it != dest->neighbours.end(); i++, it++)
-        sum += Rate((*it)->_pSite, dest);
+    for (size_t e = _graph.offset[dest]; e < _graph.offset[dest + 1]; e++)
+        sum += Rate(_graph.reverse[e]);
 
     return sum;
 }
 
+double transporter::LogRateSum(size_t dest)
+{
+    // Sum relative to the largest rate, so nothing overflows or underflows.
+    double largest = -std::numeric_limits<double>::infinity();
+    for (size_t e = _graph.offset[dest]; e < _graph.offset[dest + 1]; e++)
+        largest = std::max(largest, LogRate(_graph.reverse[e]));
+    if (!std::isfinite(largest))
+        return largest;
+
+    double sum = 0.0;
+    for (size_t e = _graph.offset[dest]; e < _graph.offset[dest + 1]; e++)
+        sum += std::exp(LogRate(_graph.reverse[e]) - largest);
+    return largest + std::log(sum);
+}
+
+double transporter::LogBoltzmannFactor(size_t s)
+{
+    const site& st = _sites[s];
+    return (_transE - (st.energy + st.pos.Z * _fieldZ + st.pos.X * _fieldX + st.pos.Y * _fieldY)) / _kBT;
+}
+
+bool transporter::FieldHasPotential() const
+{
+    const periodicBox& box = _graph.box;
+    return (box.X <= 0.0 || _fieldX == 0.0) && (box.Y <= 0.0 || _fieldY == 0.0) && (box.Z <= 0.0 || _fieldZ == 0.0);
+}
+
 // Calculate the preconditioning factor.
 // This is used to transform the rate matrix into a form more suitable for solving numerically.
-double transporter::PrecondFactor(site* pSite, PrecondForm form)
+double transporter::PrecondFactor(size_t s, PrecondForm form)
 {
     // Could use interface / implementation instead of enum / switch
     switch (form)
@@ -73,13 +151,13 @@ double transporter::PrecondFactor(site* pSite, PrecondForm form)
         return 1.0;
 
     case PrecondForm::boltzmann:
-        return std::exp((_transE - (pSite->energy + pSite->pos.Z * _fieldZ)) / _kBT);
+        return std::exp(LogBoltzmannFactor(s));
 
     case PrecondForm::boltzmannSquared:
-        return std::pow(std::exp((_transE - (pSite->energy + pSite->pos.Z * _fieldZ)) / _kBT), 2.0);
+        return std::pow(std::exp(LogBoltzmannFactor(s)), 2.0);
 
     case PrecondForm::rateSum:
-        return 1.0 / RateSum(pSite);
+        return 1.0 / RateSum(s);
 
     default:
         throw std::logic_error("Form of preconditioning factor not implemented.");
@@ -88,40 +166,99 @@ double transporter::PrecondFactor(site* pSite, PrecondForm form)
     }
 }
 
-gsl_matrix* transporter::CreateRateMatrix(std::vector<site>& sites, PrecondForm form, bool scale, bool verbose)
+double transporter::LogPrecondFactor(size_t s, PrecondForm form)
+{
+    switch (form)
+    {
+
+    case PrecondForm::off:
+        return 0.0;
+
+    case PrecondForm::boltzmann:
+        return LogBoltzmannFactor(s);
+
+    case PrecondForm::boltzmannSquared:
+        return 2.0 * LogBoltzmannFactor(s);
+
+    case PrecondForm::rateSum:
+        return -LogRateSum(s);
+
+    default:
+        throw std::logic_error("Form of preconditioning factor not implemented.");
+        return 0.0;
+
+    }
+}
+
+void transporter::RemovePreconditioning(std::vector<double>& P, PrecondForm form)
+{
+    if (form == PrecondForm::off) return;
+
+    std::vector<double> logFactor(P.size());
+    double largest = -std::numeric_limits<double>::infinity();
+    for (size_t j = 0; j < P.size(); j++)
+    {
+        logFactor[j] = LogPrecondFactor(j, form);
+        largest = std::max(largest, logFactor[j]);
+    }
+
+    double sum = 0.0;
+    for (size_t j = 0; j < P.size(); j++)
+    {
+        P[j] *= std::exp(logFactor[j] - largest);
+        sum += P[j];
+    }
+    for (size_t j = 0; j < P.size(); j++)
+        P[j] /= sum;
+}
+
+gsl_matrix* transporter::CreateRateMatrix(PrecondForm form, bool scale, bool verbose)
 {
-    size_t M = sites.size();
+    size_t M = _sites.size();
     gsl_matrix* A = gsl_matrix_alloc(M, M);
     gsl_matrix_set_zero(A);
 
-    int highestO = -999;
-    int lowestO = 999;
-    int orderOfMag;
-    for (int i = 0; i < M; i++)
-        for (int f = 0; f < M; f++)
-        {
-            double el = 0;
-            if (i == f)
+    // Rows are independent, so fill blocks of rows in parallel.
+    // Each block keeps its own order of magnitude range, which are combined afterwards.
+    std::vector<int> blockHighestO((M + parallelBlockSize - 1) / parallelBlockSize, -999);
+    std::vector<int> blockLowestO(blockHighestO.size(), 999);
+    ParallelBlocks(M, [&](size_t b, size_t begin, size_t end)
+    {
+        int orderOfMag;
+        for (size_t i = begin; i < end; i++)
+            for (size_t f = 0; f < M; f++)
             {
-                double sum = 0.0;
-                for (int k = 0; k < M; k++)
-                    if (i != k)
-                        sum += Rate(&sites[i], &sites[k]) * PrecondFactor(&sites[i], form);
+                double el = 0;
+                if (i == f)
+                {
+                    double sum = 0.0;
+                    for (size_t k = 0; k < M; k++)
+                        if (i != k)
+                            sum += Rate(i, k) * PrecondFactor(i, form);
 
-                el = -sum;
-            }
-            else
-            {
-                el = Rate(&sites[f], &sites[i]) * PrecondFactor(&sites[f], form);
+                    el = -sum;
+                }
+                else
+                {
+                    el = Rate(f, i) * PrecondFactor(f, form);
+                }
+                gsl_matrix_set(A, i, f, el);
+                if (el) // Check el is non-zero otherwise lowestO will equal -inf
+                {
+                    orderOfMag = (int)floor(log10(std::abs(el)));
+                    if (orderOfMag > blockHighestO[b]) blockHighestO[b] = orderOfMag;
+                    if (orderOfMag < blockLowestO[b]) blockLowestO[b] = orderOfMag;
+                }
             }
-            gsl_matrix_set(A, i, f, el);
-            if (el) // Check el is non-zero otherwise lowestO will equal -inf
-            {
-                orderOfMag = (int)floor(log10(abs(el)));
-                if (orderOfMag > highestO) highestO = orderOfMag;
-                if (orderOfMag < lowestO) lowestO = orderOfMag;
-            }
-        }
+    });
+
+    int highestO = -999;
+    int lowestO = 999;
+    for (size_t b = 0; b < blockHighestO.size(); b++)
+    {
+        highestO = std::max(highestO, blockHighestO[b]);
+        lowestO = std::min(lowestO, blockLowestO[b]);
+    }
 
     if (verbose)
     {
@@ -146,20 +283,284 @@ gsl_matrix* transporter::CreateRateMatrix(std::vector<site>& sites, PrecondForm
 
 }
 
-double transporter::velocity_z(std::vector<site>& sites, gsl_matrix* A)
+sparseMatrix transporter::CreateSparseRateMatrix(PrecondForm form, bool scale, bool verbose)
 {
-    double sum = 0.0;
-    for (int i = 0; i < sites.size(); i++)
-        for (int j = 0; j < sites.size(); j++)
-            if (i != j)
+    size_t M = _sites.size();
+    sparseMatrix A;
+    A.size = M;
+    A.rowStart.resize(M + 1);
+    A.col.resize(_graph.numEdges() + M);
+    A.val.resize(_graph.numEdges() + M);
+
+    int highestO, lowestO;
+    if (_logDomain)
+        fillLogSparseRateMatrix(A, form, scale, highestO, lowestO);
+    else
+        fillSparseRateMatrix(A, form, highestO, lowestO);
+
+    if (verbose)
+    {
+        printMatrix(A);
+        std::cout << "\nValues:\nMax = " << A.max() << "\nMin = " << A.min() << "\nRange = " << A.max() - A.min() << "\n";
+        std::cout << "\nOrder of magnitude:\nHighest = " << highestO << "\nLowest = " << lowestO << "\nDiff = " << highestO - lowestO << "\n";
+        std::cout << "Non-zero elements = " << A.nnz() << "\n";
+    }
+
+    if (scale)
+    {
+        std::cout << "\nTo reduce precision errors, rescale A by 1e-" << highestO << "\n";
+        if (!_logDomain) // Already rescaled during assembly
+            A.scale(pow(10, -highestO));
+
+        if (verbose)
+        {
+            std::cout << "Reduced A = \n";
+            printMatrix(A);
+        }
+    }
+
+    return A;
+
+}
+
+void transporter::UpdateSparseRateMatrix(sparseMatrix& A, PrecondForm form)
+{
+    int highestO, lowestO;
+    if (_logDomain)
+        fillLogSparseRateMatrix(A, form, false, highestO, lowestO);
+    else
+        fillSparseRateMatrix(A, form, highestO, lowestO);
+}
+
+void transporter::fillSparseRateMatrix(sparseMatrix& A, PrecondForm form, int& highestO, int& lowestO)
+{
+    size_t M = _sites.size();
+
+    // Preconditioning factors only depend on the site, so evaluate each once.
+    std::vector<double> factor(M);
+    ParallelFor(M, [&](size_t s) { factor[s] = PrecondFactor(s, form); });
+
+    // Row i holds one element per edge leaving i plus the diagonal, so every row's position
+    // in A is known in advance and blocks of rows can be filled in parallel.
+    // Each block keeps its own order of magnitude range, which are combined afterwards.
+    std::vector<int> blockHighestO((M + parallelBlockSize - 1) / parallelBlockSize, -999);
+    std::vector<int> blockLowestO(blockHighestO.size(), 999);
+    ParallelBlocks(M, [&](size_t b, size_t begin, size_t end)
+    {
+        int orderOfMag;
+        for (size_t i = begin; i < end; i++)
+        {
+            size_t nnz = _graph.offset[i] + i;
+            A.rowStart[i] = nnz;
+
+            // Off-diagonal elements (i,f) are the rates from each neighbour f into i.
+            // The diagonal element is minus the sum of all rates out of i.
+            // Edges leaving i are sorted by destination, so the row is filled in column order
+            // with the diagonal inserted in front of the first neighbour beyond i.
+            size_t diag = 0;
+            bool diagPlaced = false;
+            double sum = 0.0;
+            for (size_t e = _graph.offset[i]; e < _graph.offset[i + 1]; e++)
             {
-                double deltaZ = (sites[j].pos.Z - sites[i].pos.Z);
+                size_t f = _graph.dest[e];
+                if (!diagPlaced && f > i)
+                {
+                    diag = nnz++;
+                    diagPlaced = true;
+                }
 
-                // If periodic boundaries in z, then apply the minimum image convention.
-                if (_periodic) deltaZ -= _sizeZ * floor(deltaZ * _rsizeZ + 0.5);
+                A.col[nnz] = f;
+                A.val[nnz] = Rate(_graph.reverse[e]) * factor[f];
+                nnz++;
+                sum += Rate(e) * factor[i];
+            }
+            if (!diagPlaced)
+                diag = nnz++;
+            A.col[diag] = i;
+            A.val[diag] = -sum;
 
-                sum += deltaZ * gsl_matrix_get(A, i, j) * sites[j].occProb;
+            for (size_t k = A.rowStart[i]; k < nnz; k++)
+            {
+                double el = A.val[k];
+                if (el) // Check el is non-zero otherwise lowestO will equal -inf
+                {
+                    orderOfMag = (int)floor(log10(std::abs(el)));
+                    if (orderOfMag > blockHighestO[b]) blockHighestO[b] = orderOfMag;
+                    if (orderOfMag < blockLowestO[b]) blockLowestO[b] = orderOfMag;
+                }
             }
-    
-    return sum;
-}
\ No newline at end of file
+        }
+    });
+    A.rowStart[M] = _graph.numEdges() + M;
+
+    highestO = -999;
+    lowestO = 999;
+    for (size_t b = 0; b < blockHighestO.size(); b++)
+    {
+        highestO = std::max(highestO, blockHighestO[b]);
+        lowestO = std::min(lowestO, blockLowestO[b]);
+    }
+}
+
+void transporter::fillLogSparseRateMatrix(sparseMatrix& A, PrecondForm form, bool scale, int& highestO, int& lowestO)
+{
+    size_t M = _sites.size();
+    const double ln10 = std::log(10.0);
+
+    std::vector<double> logFactor(M);
+    ParallelFor(M, [&](size_t s) { logFactor[s] = LogPrecondFactor(s, form); });
+
+    // First pass: the same layout as fillSparseRateMatrix, with the log of the magnitude of each element in val.
+    // The diagonal is the log of the sum of rates out of i, summed relative to the largest.
+    std::vector<int> blockHighestO((M + parallelBlockSize - 1) / parallelBlockSize, -999);
+    std::vector<int> blockLowestO(blockHighestO.size(), 999);
+    ParallelBlocks(M, [&](size_t b, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            size_t nnz = _graph.offset[i] + i;
+            A.rowStart[i] = nnz;
+
+            size_t diag = 0;
+            bool diagPlaced = false;
+            double largest = -std::numeric_limits<double>::infinity();
+            for (size_t e = _graph.offset[i]; e < _graph.offset[i + 1]; e++)
+            {
+                size_t f = _graph.dest[e];
+                if (!diagPlaced && f > i)
+                {
+                    diag = nnz++;
+                    diagPlaced = true;
+                }
+
+                A.col[nnz] = f;
+                A.val[nnz] = LogRate(_graph.reverse[e]) + logFactor[f];
+                nnz++;
+                largest = std::max(largest, LogRate(e));
+            }
+            if (!diagPlaced)
+                diag = nnz++;
+
+            double sum = 0.0;
+            if (std::isfinite(largest))
+                for (size_t e = _graph.offset[i]; e < _graph.offset[i + 1]; e++)
+                    sum += std::exp(LogRate(e) - largest);
+            A.col[diag] = i;
+            A.val[diag] = largest + std::log(sum) + logFactor[i];
+
+            for (size_t k = A.rowStart[i]; k < nnz; k++)
+            {
+                double logEl = A.val[k];
+                if (std::isfinite(logEl)) // Zero elements have no order of magnitude
+                {
+                    int orderOfMag = (int)floor(logEl / ln10);
+                    if (orderOfMag > blockHighestO[b]) blockHighestO[b] = orderOfMag;
+                    if (orderOfMag < blockLowestO[b]) blockLowestO[b] = orderOfMag;
+                }
+            }
+        }
+    });
+    A.rowStart[M] = _graph.numEdges() + M;
+
+    highestO = -999;
+    lowestO = 999;
+    for (size_t b = 0; b < blockHighestO.size(); b++)
+    {
+        highestO = std::max(highestO, blockHighestO[b]);
+        lowestO = std::min(lowestO, blockLowestO[b]);
+    }
+
+    // Second pass: exponentiate, with the diagonal negative.
+    double shift = scale ? highestO * ln10 : 0.0;
+    ParallelFor(M, [&](size_t i)
+    {
+        for (size_t k = A.rowStart[i]; k < A.rowStart[i + 1]; k++)
+        {
+            double el = std::exp(A.val[k] - shift);
+            A.val[k] = (A.col[k] == i) ? -el : el;
+        }
+    });
+}
+
+double transporter::velocity_z()
+{
+    std::vector<double> P(_sites.size());
+    for (size_t s = 0; s < _sites.size(); s++)
+        P[s] = _sites[s].occProb;
+
+    return velocity_z(P);
+}
+
+double transporter::velocity_z(const std::vector<double>& P)
+{
+    // Each edge e carries charge from site j = origin[e] to site i = dest[e] at rate Rate(e) * P_j.
+    // Summed over fixed blocks of edges, so the result doesn't depend on the number of threads.
+    return ParallelSum(_graph.numEdges(), [&](size_t e)
+    {
+        size_t j = _graph.origin[e];
+
+        // deltaZ is measured from i to j, i.e. against the direction of the edge.
+        return -_graph.deltaZ[e] * Rate(e) * P[j];
+    });
+}
+
+void transporter::Velocity(const std::vector<double>& P, double& vX, double& vY, double& vZ)
+{
+    vX = -ParallelSum(_graph.numEdges(), [&](size_t e) { return _graph.deltaX[e] * Rate(e) * P[_graph.origin[e]]; });
+    vY = -ParallelSum(_graph.numEdges(), [&](size_t e) { return _graph.deltaY[e] * Rate(e) * P[_graph.origin[e]]; });
+    vZ = velocity_z(P);
+}
+
+void transporter::Velocity(double& vX, double& vY, double& vZ)
+{
+    std::vector<double> P(_sites.size());
+    for (size_t s = 0; s < _sites.size(); s++)
+        P[s] = _sites[s].occProb;
+
+    Velocity(P, vX, vY, vZ);
+}
+
+std::vector<double> transporter::SiteVelocityZ(const std::vector<double>& P)
+{
+    std::vector<double> v(_sites.size(), 0.0);
+    ParallelFor(_sites.size(), [&](size_t j)
+    {
+        double sum = 0.0;
+        for (size_t e = _graph.offset[j]; e < _graph.offset[j + 1]; e++)
+            sum -= _graph.deltaZ[e] * Rate(e);
+        v[j] = sum * P[j];
+    });
+    return v;
+}
+
+fluxMap transporter::FluxMap(const std::vector<double>& P)
+{
+    const size_t M = _sites.size();
+    fluxMap flux;
+    flux.edge.resize(_graph.numEdges());
+    flux.divergence.resize(M);
+    flux.siteX.resize(M);
+    flux.siteY.resize(M);
+    flux.siteZ.resize(M);
+
+    // Each site evaluates the edges leaving it, so every value is written by one thread only.
+    ParallelFor(M, [&](size_t j)
+    {
+        double out = 0.0, x = 0.0, y = 0.0, z = 0.0;
+        for (size_t e = _graph.offset[j]; e < _graph.offset[j + 1]; e++)
+        {
+            double f = Rate(e) * P[j] - Rate(_graph.reverse[e]) * P[_graph.dest[e]];
+            flux.edge[e] = f;
+            out += f;
+            x += f * _graph.deltaX[e];
+            y += f * _graph.deltaY[e];
+            z += f * _graph.deltaZ[e];
+        }
+        flux.divergence[j] = out;
+        // Signed as velocity_z, i.e. against the displacement.
+        flux.siteX[j] = -0.5 * x;
+        flux.siteY[j] = -0.5 * y;
+        flux.siteZ[j] = -0.5 * z;
+    });
+    return flux;
+}
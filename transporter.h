@@ -1,35 +1,100 @@
 #pragma once
 #include "pch.h"
 #include "site.h"
+#include "graph.h"
+#include "sparse.h"
+
+// Net flow of charge along every edge and through every site, for a given occupation P (see transporter::FluxMap).
+struct fluxMap
+{
+	// Net rate of transfer along each edge e of the site graph (1/s): Rate(e) P[origin] - Rate(reverse) P[dest].
+	// The two edges of a pair carry opposite values.
+	std::vector<double> edge;
+
+	// Net outflow from each site (1/s), the sum of edge over the edges leaving it. Zero at steady state.
+	std::vector<double> divergence;
+
+	// Current through each site (Ang/s): half the sum over the edges leaving it of edge times the displacement along the edge,
+	// so each pair's current is shared between its two sites. Signed as velocity_z (positive for charge moving towards -z,
+	// along the force of a positive field), so siteZ sums to velocity_z(P).
+	std::vector<double> siteX;
+	std::vector<double> siteY;
+	std::vector<double> siteZ;
+};
 
 class transporter
 {
 private:
 
+	// The sites and interactions charges are transported through.
+	const std::vector<site>& _sites;
+	const siteGraph& _graph;
+
 	const double _kBT;
-	const double _fieldZ;
+
+	// Electric field vector (V/Ang).
+	double _fieldX;
+	double _fieldY;
+	double _fieldZ;
 	const double _reorg;
 	const double _transE;
-	const bool _periodic;
-	const double _sizeZ;
-	const double _rsizeZ;
+
+	// Loop invariant factors of the Marcus rate: (2 pi / hbar) (4 pi reorg kBT)^-1/2 and 1 / (4 reorg kBT).
+	const double _prefactor;
+	const double _rdenom;
+
+	// Transfer rate along each edge of _graph, all evaluated together whenever the field is set.
+	std::vector<double> _rate;
+
+	// Change in potential energy (eV) along each edge due to a field with x or y components: the displacement along the edge dotted
+	// with the field. Empty for a field along z alone, when the rate kernels take deltaZ and fieldZ directly.
+	std::vector<double> _fieldEnergy;
+
+	// With log domain rates, the natural log of each rate is kept as well, and the rate matrix is assembled from logs (see CreateSparseRateMatrix).
+	const bool _logDomain;
+	std::vector<double> _logRate;
 
 public:
 
-	// Construct a transporter object
-	transporter(double kBT, double fieldZ, double reorg, double transE, bool periodic, double sizeZ);
+	// Construct a transporter object.
+	// The graph must already have its per-edge geometry set (siteGraph::SetGeometry), which includes any periodic boundaries.
+	// logDomain keeps the rates as logs, for rates and preconditioning factors spanning more orders of magnitude than a double.
+	transporter(const std::vector<site>& sites, const siteGraph& graph, double kBT, double fieldZ, double reorg, double transE, bool logDomain = false);
+
+	// As above, with a field in any direction.
+	transporter(const std::vector<site>& sites, const siteGraph& graph, double kBT, double fieldX, double fieldY, double fieldZ,
+		double reorg, double transE, bool logDomain = false);
+
+	// Change the field, and re-evaluate the rate along every edge (forward and reverse) in a single vectorised pass over the graph.
+	// Only the field-dependent part of each rate changes; the rest is cached per edge by the graph.
+	void SetField(double fieldX, double fieldY, double fieldZ);
+
+	// Change the z component of the field, keeping the others.
+	void SetFieldZ(double fieldZ);
+
+	// Calculate the energetic driving force for the transfer of a charge along edge e of the site graph.
+	// The displacement along the edge follows the minimum image convention if the graph is periodic.
+	double deltaE(size_t e);
+
+	// The transfer rate along edge e of the site graph.
+	double Rate(size_t e) { return _rate[e]; }
+
+	// The natural log of the transfer rate along edge e, exact (not the log of an underflowed rate) with log domain rates.
+	double LogRate(size_t e) { return _logDomain ? _logRate[e] : std::log(_rate[e]); }
 
-	// Calculate the energetic driving force for the transfer of a charge from this site (as initial) to the site passed as pointer (as final).
-	// If periodic is true then use the minimum image convention to find the shortest path to from this site to the target site.
-	double deltaE(site* orig, site* dest);
+	// Largest relative difference between the cached rates (from the vectorised kernel)
+	// and the same rates evaluated one at a time by the original scalar formula.
+	double CheckRates();
 
 	// Calculate the transfer rate between two sites.
 	// If the passed sites are not interacting, the rate will be zero.
-	// Only performs the full calculation the first time this function is called (for this this specific rate).
-	double Rate(site* orig, site* dest);
+	double Rate(size_t orig, size_t dest);
 
 	// Calculate the sum of all transfer rates into the specified site.
-	double RateSum(site* dest);
+	double RateSum(size_t dest);
+
+	// The natural log of RateSum(dest), summed from the log rates.
+	double LogRateSum(size_t dest);
 
 	// Alternative forms of preconditioning factor
 	// (Rather than enum could treat site as an interface, 
@@ -37,31 +102,67 @@ public:
 	//  and each form as a different implementation)
 	enum class PrecondForm { off, boltzmann, boltzmannSquared, rateSum };
 
+	// Log of the Boltzmann factor exp((transE - (energy + pos . field)) / kBT) of site s, i.e. of PrecondFactor(s, PrecondForm::boltzmann).
+	// The rates satisfy detailed balance with respect to these factors whenever the field has a well defined potential:
+	// always in a non-periodic system, and at zero field in a periodic one.
+	double LogBoltzmannFactor(size_t s);
+
+	// Whether the field has a well defined potential, i.e. no component along a periodic axis, so that detailed balance holds.
+	bool FieldHasPotential() const;
+
 	// Calculate the preconditioning factor.
 	// This is used to transform the rate matrix into a form more suitable for solving numerically.
-	double PrecondFactor(site* pSite, PrecondForm form);
+	double PrecondFactor(size_t s, PrecondForm form);
 
-	gsl_matrix* CreateRateMatrix(std::vector<site>& sites, PrecondForm form, bool scale, bool verbose);
+	// The natural log of PrecondFactor(s, form), which doesn't overflow for the boltzmann forms at large disorder.
+	double LogPrecondFactor(size_t s, PrecondForm form);
 
-	// Use the occupation probability of sites and the rate equation, to find the average velocity of charges in Ang/s
-	double velocity_z(std::vector<site>& sites, gsl_matrix* A);
+	// Turn the steady state P of the rate matrix conditioned by form back into occupation probabilities:
+	// multiply by the preconditioning factors, relative to the largest so none overflows, and renormalise so P sums to 1.
+	void RemovePreconditioning(std::vector<double>& P, PrecondForm form);
 
-};
+	// Build the (optionally preconditioned and rescaled) rate matrix as a dense M x M matrix.
+	// Every element is evaluated, so this scales as O(M^3). Retained for comparison with CreateSparseRateMatrix.
+	gsl_matrix* CreateRateMatrix(PrecondForm form, bool scale, bool verbose);
 
-// A structure used to specify
-// which other sites the parent site interacts with,
-// and the strength of interactions.
-// Full definition in transporter.h
-struct site::neighbour
-{
-	site* _pSite = NULL;
-	double _J = 0.0;
-	private: // Make sure only the function Rate() has access to the member below.
-		friend double transporter::Rate(site* orig, site* dest);
-		double _rate = -1.0; // -1 for not yet set, the rate will be updated the first time it is needed.
-};
+	// Build the same rate matrix as CreateRateMatrix in CSR form, directly from the edges of the site graph.
+	// Only the non-zero elements (one per interacting pair plus the diagonal) are evaluated.
+	// With log domain rates each element is formed as exp(log rate + log factor - log scale), so neither the product
+	// of a rate and factor nor the element before rescaling has to be representable, only the rescaled element.
+	sparseMatrix CreateSparseRateMatrix(PrecondForm form, bool scale, bool verbose);
+
+	// Overwrite the values of a rate matrix previously made by CreateSparseRateMatrix (without rescaling),
+	// reusing its storage and sparsity pattern. Used after SetFieldZ to avoid rebuilding the matrix.
+	void UpdateSparseRateMatrix(sparseMatrix& A, PrecondForm form);
 
+	// Use the occupation probability of sites and the transfer rates, to find the average velocity of charges in Ang/s
+	double velocity_z();
 
+	// As above, but with the occupation probability of each site given by P rather than read from the sites.
+	double velocity_z(const std::vector<double>& P);
 
+	// Every component of the average velocity of charges (Ang/s) for occupation probabilities P, each signed as velocity_z.
+	void Velocity(const std::vector<double>& P, double& vX, double& vY, double& vZ);
 
+	// As above, but with the occupation probability of each site read from the sites.
+	void Velocity(double& vX, double& vY, double& vZ);
 
+	// The contribution of the charge on each site to velocity_z(P): the current in z (Ang/s) carried by the edges leaving it.
+	// These sum to velocity_z(P).
+	std::vector<double> SiteVelocityZ(const std::vector<double>& P);
+
+	// The net flow along every edge, and the divergence and current in x, y and z of every site, in one parallel pass over the edges.
+	// Uses the cached rates, and the displacements cached by the graph (minimum image, as deltaE).
+	fluxMap FluxMap(const std::vector<double>& P);
+
+private:
+
+	// Fill the column indices and values of A (already sized for the graph) with the rate matrix.
+	// Also finds the highest and lowest order of magnitude of the non-zero elements.
+	void fillSparseRateMatrix(sparseMatrix& A, PrecondForm form, int& highestO, int& lowestO);
+
+	// As fillSparseRateMatrix, from the log rates and log preconditioning factors. If scale is set,
+	// the elements are divided by 10^highestO in the exponent, rather than afterwards.
+	void fillLogSparseRateMatrix(sparseMatrix& A, PrecondForm form, bool scale, int& highestO, int& lowestO);
+
+};
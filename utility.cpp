@@ -1,55 +1,56 @@
 #include "pch.h"
 #include "utility.h"
+#include "output.h"
 
+// Each printing function formats into an outputBuffer, which writes to std::cout in large blocks.
 void printMatrix(gsl_matrix* m)
 {
-    std::stringstream sstream;
-    sstream.setf(std::ios::scientific);
-    sstream.precision(2);
-
-    for (int i = 0; i < m->size1; i++)
+    outputBuffer out(std::cout);
+    for (size_t i = 0; i < m->size1; i++)
     {
-        for (int j = 0; j < m->size2; j++)
+        for (size_t j = 0; j < m->size2; j++)
         {
             double el = gsl_matrix_get(m, i, j);
             if (el)
-                sstream << std::setw(10) << std::left << el;
+                out.line("%-10.2e", el);
             else
-                sstream << std::setw(10) << std::left << "0";
+                out.line("%-10s", "0");
         }
-        std::cout << sstream.str() << "\n";
-        sstream.str("");
+        out.line("\n");
     }
 }
 
-void printVector(gsl_vector* v, bool horizontal)
+void printMatrix(const sparseMatrix& m)
 {
-    std::stringstream sstream;
-    sstream.setf(std::ios::scientific);
-    sstream.precision(2);
-
-    if (horizontal)
+    outputBuffer out(std::cout);
+    for (size_t i = 0; i < m.size; i++)
     {
-        sstream << "( ";
-        for (size_t i = 0; i < v->size; i++)
+        size_t k = m.rowStart[i];
+        for (size_t j = 0; j < m.size; j++)
         {
-            double el = gsl_vector_get(v, i);
-            if (el) sstream << el; else sstream << "0";
-            if (i < v->size - 1) sstream << ", ";
+            // Walk along the stored entries of the row as the columns are visited in order.
+            if (k < m.rowStart[i + 1] && m.col[k] == j && m.val[k])
+                out.line("%-10.2e", m.val[k]);
+            else
+                out.line("%-10s", "0");
+            if (k < m.rowStart[i + 1] && m.col[k] == j) k++;
         }
-        sstream << " )\n";
+        out.line("\n");
     }
-    else 
+}
+
+void printVector(gsl_vector* v, bool horizontal)
+{
+    outputBuffer out(std::cout);
+    if (horizontal) out.line("( ");
+    for (size_t i = 0; i < v->size; i++)
     {
-        for (size_t i = 0; i < v->size; i++)
-        {
-            double el = gsl_vector_get(v, i);
-            if (el) sstream << el; else sstream << "0";
-            sstream << "\n";
-        }
+        double el = gsl_vector_get(v, i);
+        if (el) out.line("%.2e", el); else out.line("0");
+        if (!horizontal) out.line("\n");
+        else if (i < v->size - 1) out.line(", ");
     }
-
-    std::cout << sstream.str();
+    if (horizontal) out.line(" )\n");
 }
 
 void printDiagonal(gsl_matrix* m, bool horizontal)
@@ -66,33 +67,16 @@ void printDiagonal(gsl_matrix* m, bool horizontal)
 
 void printOccProbs(std::vector<site>& sites, int precision)
 {
-    std::stringstream sstreamXYZ;
-    sstreamXYZ.setf(std::ios::fixed);
-    sstreamXYZ.precision(0);
-
-    std::stringstream sstreamProbs;
-    sstreamProbs.setf(std::ios::scientific);
-    sstreamProbs.precision(precision);
-
-    for (int i = 0; i < sites.size(); i++)
-    {
-        sstreamXYZ << std::setw(6) << std::left << sites[i].pos.X
-            << std::setw(6) << std::left << sites[i].pos.Y
-            << std::setw(6) << std::left << sites[i].pos.Z;
-        sstreamProbs << std::setw(12) << std::left << sites[i].occProb;
-
-        std::cout << sstreamXYZ.str() << sstreamProbs.str() << "\n";
-        sstreamXYZ.str("");
-        sstreamProbs.str("");
-    }
-
+    outputBuffer out(std::cout);
+    for (size_t i = 0; i < sites.size(); i++)
+        out.line("%-6.0f%-6.0f%-6.0f%-12.*e\n", sites[i].pos.X, sites[i].pos.Y, sites[i].pos.Z, precision, sites[i].occProb);
 }
 
 void normalise(gsl_vector* v)
 {
     // Find quadrature sum
     double qsum = 0;
-    for (int i = 0; i < v->size; i++)
+    for (size_t i = 0; i < v->size; i++)
         qsum += pow(gsl_vector_get(v, i), 2);
 
     // Rescale all elements by 1/sum
@@ -1,9 +1,12 @@
 #pragma once
 #include "pch.h"
 #include "site.h"
+#include "sparse.h"
 
 void printMatrix(gsl_matrix* m);
 
+void printMatrix(const sparseMatrix& m);
+
 void printVector(gsl_vector* v, bool horizontal = false);
 
 void printDiagonal(gsl_matrix* m, bool horizontal = false);